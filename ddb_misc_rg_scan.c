@@ -28,6 +28,18 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
 
 #include <deadbeef/deadbeef.h>              // deadbeef SDK
 #include <ebur128.h>                        // libEBUR128
@@ -44,248 +56,1747 @@ DB_plugin_t* ddb_misc_replaygain_scan_load (DB_functions_t *api) {
     return DB_PLUGIN (&plugin);
 }
 
-struct rg_thread_arg
+/* state shared by all workers of one rg_scan call */
+struct rg_scan_job
 {
-    int result;                     /* result of this thread */
-    const int thread_id;            /* number of this thread */
     DB_playItem_t **scan_items;     /* tracks to scan */
+    int num_tracks;                 /* how many tracks */
     float *out_track_rg;            /* individual track replay gain */
     float *out_track_pk;            /* indivirual track peak */
+    float *out_track_err;           /* bound of estimated track gains, NULL unless sampling */
     const float *targetdb;          /* our target loudness */
     int *abort;                     /* will be set to 1 if scanning was aborted */
-    ebur128_state **status_gain;
-    ebur128_state **status_peak;
+    struct rg_work_item *items;     /* work in the order it is handed out */
+    int num_items;                  /* how many work items */
+    ebur128_state **status;         /* one per work item, freed when its track is done */
+    ebur128_summary album;          /* gating blocks of all finished tracks */
+    int *first_item;                /* first work item of each track */
+    int *segments_left;             /* segments of each track still being scanned */
+    char *failed;                   /* set for tracks of which a segment failed to scan */
+    float segment_length;           /* length of a segment in seconds */
+    int quick_windows;              /* windows measured per track, 0 = measure everything */
+    int pipeline;                   /* decode and analyse on separate threads */
+    int read_frames;                /* frames per dec->read, 0 = tuned per decoder */
+    int ebur128_mode;               /* extra libebur128 mode flags for every state */
+    int direct_pcm;                 /* read uncompressed WAV and AIFF files without their decoder */
+    uintptr_t mutex;                /* protects next_item, taken, devices, open_files, segments_left, failed, album and prefetch */
+    int next_item;                  /* next work item to be handed out */
+    struct rg_device *devices;      /* disks the files are on, NULL unless needed */
+    int num_devices;
+    int disk_readers;               /* workers reading from one disk at once, 0 = no limit */
+    char *taken;                    /* items handed out, NULL unless readers are limited */
+    uintptr_t reader_cond;          /* signalled when a worker stops reading from a disk */
+    unsigned long reader_waits;     /* items a worker had to wait for a disk for */
+    int max_open_files;             /* decoders open at once, 0 = no limit */
+    int open_files;                 /* decoders open now */
+    int peak_open_files;
+    uintptr_t files_cond;           /* signalled when a decoder is freed, 0 unless limited */
+    unsigned long file_waits;       /* items a worker had to wait to open a decoder for */
+    struct rg_prefetch *prefetch;   /* reads files ahead of the workers, NULL if off */
+};
+
+/*
+ * A piece of work handed out to a worker: a whole track, or one segment of
+ * a long track. Segments of a track are scanned in parallel and always
+ * follow each other in the list of work items.
+ */
+struct rg_work_item
+{
+    int track;                      /* index into scan_items */
+    int segment;                    /* number of this segment */
+    int num_segments;               /* how many segments the track was split into */
+    int sampled;                    /* segments are sampling windows, not the whole track */
+    int device;                     /* index into job->devices */
+    float duration;                 /* seconds of audio in this item */
+};
+
+/* used to sort tracks by duration or by where they are on disk */
+struct rg_track_duration
+{
+    int track;
+    float duration;
+    int num_segments;
+    int sampled;
+    int device;
+    int located;                    /* one of RG_LOCATED_* */
+    uint64_t location;
+};
+
+/* orders in which the tracks are scanned, see rgscan.schedule */
+enum {
+    RG_SCHEDULE_SELECTION,          /* as selected */
+    RG_SCHEDULE_LONGEST_FIRST,      /* longest first, the short tracks fill the gaps */
+    RG_SCHEDULE_DISK,               /* by where the files are on disk */
+};
+
+static const char *rg_schedule_names[] = { "selection", "longest_first", "disk" };
+#define RG_SCHEDULES (int) (sizeof (rg_schedule_names) / sizeof (rg_schedule_names[0]))
+
+/* a disk the scanned files are on, the first one stands for everything not a local file */
+struct rg_device
+{
+    dev_t dev;
+    int readers;                    /* workers reading from it */
+    int left;                       /* items on it which have not been handed out */
+};
+
+#define RG_NO_DEVICE 0
+
+/* what the location of a file is */
+enum {
+    RG_LOCATED_EXTENT,              /* physical offset of its first extent */
+    RG_LOCATED_INODE,               /* the filesystem can't tell, inode number */
+    RG_LOCATED_NONE,                /* not a local file */
+};
+
+/* how many idle ebur128 states each worker keeps for the next tracks */
+#define RG_POOL_STATES 4
+
+/*
+ * Frames per dec->read. Small reads cost a decoder call and a libebur128
+ * call each, large ones no longer fit the caches between decoding and
+ * analysis, so unless rgscan.read_frames is set, each worker tries these
+ * sizes on the first items of each decoder and keeps the fastest.
+ */
+static const int rg_read_sizes[] = { 8192, 16384, 32768, 65536 };
+#define RG_READ_SIZES (int) (sizeof (rg_read_sizes) / sizeof (rg_read_sizes[0]))
+#define RG_READ_FRAMES_DEFAULT 16384
+#define RG_TUNED_DECODERS 8
+
+/* read size tuning of one decoder */
+struct rg_read_tuning
+{
+    DB_decoder_t *dec;
+    int trial;                      /* next size to try, RG_READ_SIZES once done */
+    int frames;                     /* fastest size so far */
+    double rate;                    /* frames per second scanned with it */
+};
+
+/* a long-lived scanning thread, pulls tracks from the job until none are left */
+struct rg_worker
+{
+    struct rg_scan_job *job;
+    int worker_id;
+    char *buffer;                   /* decoder output, reused across tracks */
+    size_t buffer_size;
+    char *converted;                /* see rg_read_block */
+    size_t converted_size;
+    struct rg_ring *ring;           /* decoded blocks, in pipelined mode */
+    ebur128_state *pool[RG_POOL_STATES]; /* states of finished tracks, for reuse */
+    int pool_size;
+    struct rg_read_tuning tuning[RG_TUNED_DECODERS]; /* read sizes of the decoders seen so far */
+    int num_tunings;
+    int items;                      /* number of work items scanned by this worker */
+    int direct_items;               /* of those, items read without a decoder */
+    double busy;                    /* seconds spent scanning */
+};
+
+/*
+ * Each segment but the first starts decoding this many 100ms blocks before
+ * its actual start, so the K-weighting filter has settled by the time the
+ * first block of the segment is measured. The filter's impulse response has
+ * decayed far below the precision of the results after 1s, so gating blocks
+ * are the same as those of a scan of the whole track and the integrated
+ * loudness of a segmented track matches a serial scan within 0.01 dB,
+ * provided the decoder seeks sample-accurately.
+ */
+#define RG_WARMUP_BLOCKS 10
+
+/*
+ * A quick scan measures this many 100ms blocks in each of its windows, every
+ * window has its own warm-up. 3s hold 27 gating blocks, enough to average
+ * over beats and phrases of most music.
+ */
+#define RG_QUICK_WINDOW_BLOCKS 30
+
+static double rg_now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* buffers start on a cache line, which also suits the widest SIMD loads */
+#define RG_BUFFER_ALIGN 64
+
+/*
+ * grows *buf to at least size bytes, keeping the allocation for later tracks.
+ * The buffers only hold one block at a time, so the contents are not kept.
+ */
+static int rg_reserve (char **buf, size_t *buf_size, size_t size)
+{
+    if (*buf_size >= size) {
+        return 0;
+    }
+    void *tmp;
+    if (posix_memalign (&tmp, RG_BUFFER_ALIGN, size) != 0) {
+        return -1;
+    }
+    free (*buf);
+    *buf = tmp;
+    *buf_size = size;
+    return 0;
+}
+
+/* path of the file a track is in, fails for tracks which are not local files */
+static int rg_local_path (DB_playItem_t *item, char *path, size_t size)
+{
+    deadbeef->pl_lock ();
+    const char *uri = deadbeef->pl_find_meta (item, ":URI");
+    int local = uri && deadbeef->is_local_file (uri);
+    if (local) {
+        snprintf (path, size, "%s", strncmp (uri, "file://", 7) ? uri : uri + 7);
+    }
+    deadbeef->pl_unlock ();
+    return local ? 0 : -1;
+}
+
+/* the position of a track's file on disk, returns one of RG_LOCATED_* */
+static int rg_locate (DB_playItem_t *item, dev_t *dev, uint64_t *location)
+{
+    char path[PATH_MAX];
+    if (rg_local_path (item, path, sizeof (path)) != 0) {
+        return RG_LOCATED_NONE;
+    }
+    int fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        return RG_LOCATED_NONE;
+    }
+    struct stat st;
+    if (fstat (fd, &st) != 0) {
+        close (fd);
+        return RG_LOCATED_NONE;
+    }
+    *dev = st.st_dev;
+    *location = st.st_ino;
+    int located = RG_LOCATED_INODE;
+
+    // ask for the first extent only, its start is where reading the file begins
+    uint64_t buf[(sizeof (struct fiemap) + sizeof (struct fiemap_extent)) / sizeof (uint64_t) + 1];
+    struct fiemap *map = (struct fiemap *) buf;
+    memset (buf, 0, sizeof (buf));
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+    if (ioctl (fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents == 1
+        && !(map->fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC))) {
+        *location = map->fm_extents[0].fe_physical;
+        located = RG_LOCATED_EXTENT;
+    }
+    close (fd);
+    return located;
+}
+
+/*
+ * Files in the order they are on disk, so a spinning disk reads them in one
+ * sweep instead of seeking back and forth. Filesystems which can't report
+ * extents (e.g. network shares) fall back to inode order, which mostly
+ * follows the order files were written in.
+ */
+static int rg_cmp_disk (const void *p1, const void *p2)
+{
+    const struct rg_track_duration *t1 = p1;
+    const struct rg_track_duration *t2 = p2;
+    if (t1->device != t2->device) {
+        return t1->device - t2->device;
+    }
+    if (t1->located != t2->located) {
+        return t1->located - t2->located;
+    }
+    if (t1->location != t2->location) {
+        return t1->location < t2->location ? -1 : 1;
+    }
+    // subtracks of one file keep selection order
+    return t1->track - t2->track;
+}
+
+static int rg_cmp_longest_first (const void *p1, const void *p2)
+{
+    const struct rg_track_duration *t1 = p1;
+    const struct rg_track_duration *t2 = p2;
+    if (t1->duration != t2->duration) {
+        return t1->duration < t2->duration ? 1 : -1;
+    }
+    // keep selection order for tracks of the same length
+    return t1->track - t2->track;
+}
+
+/* segments and windows are found by seeking, so the decoder has to support it */
+static int rg_can_seek (DB_playItem_t *item)
+{
+    deadbeef->pl_lock ();
+    DB_decoder_t *dec = (DB_decoder_t *)deadbeef->plug_get_for_id (deadbeef->pl_find_meta (item, ":DECODER"));
+    deadbeef->pl_unlock ();
+    return dec && dec->seek_sample;
+}
+
+/* number of segments a track should be split into for parallel scanning */
+static int rg_num_segments (DB_playItem_t *item, float duration, float segment_length)
+{
+    if (segment_length <= 0 || duration < 2 * segment_length || !rg_can_seek (item)) {
+        return 1;
+    }
+
+    // the last segment takes the remainder, so it can be up to twice as long
+    return (int) (duration / segment_length);
+}
+
+/*
+ * number of windows a quick scan measures a track in, 0 if it has to be
+ * scanned completely because the windows would cover half of it anyway
+ */
+static int rg_num_windows (DB_playItem_t *item, float duration, int quick_windows)
+{
+    float window = (RG_WARMUP_BLOCKS + RG_QUICK_WINDOW_BLOCKS) / 10.0f;
+    if (quick_windows <= 0 || quick_windows * window * 2 > duration || !rg_can_seek (item)) {
+        return 0;
+    }
+    return quick_windows;
+}
+
+/*
+ * Fills job->items with the work items in the order in which they will be
+ * scanned and returns the predicted makespan in seconds of audio, i.e. the
+ * duration of audio the busiest worker will have to scan when every worker
+ * takes the next item as soon as it becomes idle.
+ *
+ * The disks the files are on are only looked up for the disk order or to
+ * limit the readers per disk.
+ */
+static double rg_schedule (struct rg_scan_job *job, int num_workers, int schedule)
+{
+    struct rg_track_duration *tracks = malloc (job->num_tracks * sizeof (struct rg_track_duration));
+    double *load = calloc (num_workers, sizeof (double));
+    double makespan = 0;
+    int num_items = 0;
+    int located[RG_LOCATED_NONE + 1] = { 0 };
+
+    if (schedule == RG_SCHEDULE_DISK || job->disk_readers > 0) {
+        job->devices = calloc (job->num_tracks + 1, sizeof (struct rg_device));
+        job->num_devices = 1;
+    }
+
+    for (int i = 0; i < job->num_tracks; ++i) {
+        tracks[i].track = i;
+        tracks[i].duration = deadbeef->pl_get_item_duration (job->scan_items[i]);
+        if (tracks[i].duration < 0) {
+            tracks[i].duration = 0;
+        }
+        tracks[i].device = RG_NO_DEVICE;
+        tracks[i].located = RG_LOCATED_NONE;
+        tracks[i].location = 0;
+        if (job->devices) {
+            dev_t dev;
+            tracks[i].located = rg_locate (job->scan_items[i], &dev, &tracks[i].location);
+            if (tracks[i].located != RG_LOCATED_NONE) {
+                int d = 1;
+                while (d < job->num_devices && job->devices[d].dev != dev) {
+                    ++d;
+                }
+                if (d == job->num_devices) {
+                    job->devices[job->num_devices++].dev = dev;
+                }
+                tracks[i].device = d;
+            }
+            located[tracks[i].located]++;
+        }
+        // a sampled track is split into its windows, which are scanned in parallel anyway
+        tracks[i].num_segments = rg_num_windows (job->scan_items[i], tracks[i].duration, job->quick_windows);
+        tracks[i].sampled = tracks[i].num_segments > 0;
+        if (tracks[i].sampled) {
+            num_items += tracks[i].num_segments;
+            continue;
+        }
+        // splitting tracks only pays off if there are workers to scan the segments,
+        // in disk order files are read front to back
+        tracks[i].num_segments = 1;
+        if (num_workers > 1 && schedule != RG_SCHEDULE_DISK) {
+            tracks[i].num_segments = rg_num_segments (job->scan_items[i], tracks[i].duration, job->segment_length);
+        }
+        num_items += tracks[i].num_segments;
+    }
+    if (schedule == RG_SCHEDULE_LONGEST_FIRST) {
+        qsort (tracks, job->num_tracks, sizeof (struct rg_track_duration), rg_cmp_longest_first);
+    }
+    else if (schedule == RG_SCHEDULE_DISK) {
+        qsort (tracks, job->num_tracks, sizeof (struct rg_track_duration), rg_cmp_disk);
+        fprintf (stdout, "rg scan: disk order on %d disk(s), %d file(s) located by extent, %d by inode, %d not local\n",
+                 job->num_devices - 1, located[RG_LOCATED_EXTENT], located[RG_LOCATED_INODE], located[RG_LOCATED_NONE]);
+    }
+
+    job->items = malloc (num_items * sizeof (struct rg_work_item));
+    job->num_items = 0;
+    for (int i = 0; i < job->num_tracks; ++i) {
+        int track = tracks[i].track;
+        int num_segments = tracks[i].num_segments;
+
+        job->first_item[track] = job->num_items;
+        job->segments_left[track] = num_segments;
+        for (int seg = 0; seg < num_segments; ++seg) {
+            struct rg_work_item *item = &job->items[job->num_items++];
+            item->track = track;
+            item->segment = seg;
+            item->num_segments = num_segments;
+            item->sampled = tracks[i].sampled;
+            item->device = tracks[i].device;
+            if (job->devices) {
+                job->devices[item->device].left++;
+            }
+            item->duration = num_segments == 1 ? tracks[i].duration : job->segment_length;
+            if (seg == num_segments - 1 && num_segments > 1) {
+                item->duration = tracks[i].duration - seg * job->segment_length;
+            }
+            if (item->sampled) {
+                item->duration = (RG_WARMUP_BLOCKS + RG_QUICK_WINDOW_BLOCKS) / 10.0f;
+            }
+
+            // the next item goes to the worker which becomes idle first
+            int idle = 0;
+            for (int w = 1; w < num_workers; ++w) {
+                if (load[w] < load[idle]) {
+                    idle = w;
+                }
+            }
+            load[idle] += item->duration;
+            if (load[idle] > makespan) {
+                makespan = load[idle];
+            }
+        }
+    }
+
+    free (load);
+    free (tracks);
+    return makespan;
+}
+
+/* how decoder output is passed to libebur128 */
+enum {
+    RG_INPUT_SHORT,                 /* 16-bit, as decoded */
+    RG_INPUT_INT,                   /* 32-bit, as decoded */
+    RG_INPUT_FLOAT,                 /* 32-bit float, as decoded */
+    RG_INPUT_INT24,                 /* 24-bit, unpacked to 32-bit */
+    RG_INPUT_BIGENDIAN,             /* big-endian 16, 24 or 32-bit, unpacked to 32-bit */
+    RG_INPUT_CONVERT,               /* anything else, converted to float */
+};
+
+/* decoding position within a work item */
+struct rg_reader
+{
+    DB_decoder_t *dec;
+    DB_fileinfo_t *fileinfo;
+    const ddb_waveformat_t *fmt;
+    int fd;                         /* file read directly, -1 if decoding */
+    int64_t data;                   /* offset of the first frame in the file */
+    int64_t frames;                 /* frames in the file */
+    int64_t pos;                    /* next frame to read from the file */
+    int input;                      /* one of RG_INPUT_* */
+    int samplesize;                 /* size of a frame of decoder output in bytes */
+    int bs;                         /* how many bytes to read at once */
+    int64_t warmup;                 /* frames left before the filter has settled */
+    int64_t left;                   /* frames left in the segment, -1 = until the end */
+    int64_t decoded;                /* frames read so far */
+    int eof;                        /* set once the item has been read completely */
+    int error;                      /* errno of a failed read from the file, 0 if none */
+    int *abort;
+};
+
+static int rg_input_format (const ddb_waveformat_t *fmt)
+{
+    if (fmt->is_bigendian) {
+        return !fmt->is_float && (fmt->bps == 16 || fmt->bps == 24 || fmt->bps == 32) ? RG_INPUT_BIGENDIAN : RG_INPUT_CONVERT;
+    }
+    if (fmt->is_float) {
+        return fmt->bps == 32 ? RG_INPUT_FLOAT : RG_INPUT_CONVERT;
+    }
+    switch (fmt->bps) {
+    case 16:
+        return RG_INPUT_SHORT;
+    case 24:
+        return RG_INPUT_INT24;
+    case 32:
+        return RG_INPUT_INT;
+    }
+    return RG_INPUT_CONVERT;
+}
+
+/* size of a block of decoder output once converted, 0 if it is used as is */
+static size_t rg_converted_size (const struct rg_reader *r)
+{
+    int samples = r->bs / r->samplesize * r->fmt->channels;
+    switch (r->input) {
+    case RG_INPUT_INT24:
+    case RG_INPUT_BIGENDIAN:
+        return samples * sizeof (int32_t);
+    case RG_INPUT_CONVERT:
+        return samples * sizeof (float);
+    }
+    return 0;
+}
+
+/*
+ * 24-bit samples are moved to the top of a 32-bit int, which also scales
+ * them to the full range libebur128 expects for ints
+ */
+static void rg_unpack_s24 (const uint8_t *in, int32_t *out, int samples)
+{
+    for (int i = 0; i < samples; ++i, in += 3) {
+        out[i] = (int32_t) ((uint32_t) in[0] << 8 | (uint32_t) in[1] << 16 | (uint32_t) in[2] << 24);
+    }
+}
+
+/* big-endian samples of any width are moved to the top of a 32-bit int */
+static void rg_unpack_be (const uint8_t *in, int32_t *out, int samples, int width)
+{
+    for (int i = 0; i < samples; ++i, in += width) {
+        uint32_t v = 0;
+        for (int b = 0; b < width; ++b) {
+            v |= (uint32_t) in[b] << (24 - 8 * b);
+        }
+        out[i] = (int32_t) v;
+    }
+}
+
+/*
+ * Decodes the next block of the item into buffer and, if libebur128 can't
+ * take the decoder output as is, converts it into converted. Returns the
+ * number of frames decoded, warmup_end is set if the block completes the
+ * filter warm-up, after which everything measured so far must be dropped.
+ */
+static int rg_read_block (struct rg_reader *r, char *buffer, char *converted, int *warmup_end)
+{
+    *warmup_end = 0;
+
+    // don't read past the end of the warm-up or of the segment
+    int want = r->bs;
+    if (r->warmup > 0 && r->warmup * r->samplesize < want) {
+        want = (int) r->warmup * r->samplesize;
+    }
+    else if (r->warmup == 0 && r->left >= 0 && r->left * r->samplesize < want) {
+        want = (int) r->left * r->samplesize;
+    }
+    if (want == 0) {
+        r->eof = 1;
+        return 0;
+    }
+
+    int sz;
+    if (r->fd >= 0) {
+        // a file which got shorter meanwhile ends early, just like a decoder would
+        int64_t avail = (r->frames - r->pos) * r->samplesize;
+        size_t size = want < avail ? (size_t) want : (size_t) avail;
+        off_t offset = r->data + r->pos * r->samplesize;
+        size_t got = 0;
+        while (got < size) {
+            ssize_t res = pread (r->fd, buffer + got, size - got, offset + (off_t) got);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            if (res < 0) {
+                r->error = errno;
+                break;
+            }
+            if (res == 0) {
+                break;
+            }
+            got += (size_t) res;
+        }
+        sz = (int) got - (int) got % r->samplesize;
+        r->pos += sz / r->samplesize;
+    }
+    else {
+        sz = r->dec->read (r->fileinfo, buffer, want); // read one sample
+    }
+    if (sz != want) {
+        r->eof = 1;
+    }
+    int frames = sz / r->samplesize;
+    r->decoded += frames;
+
+    if (r->input == RG_INPUT_INT24) {
+        rg_unpack_s24 ((const uint8_t *) buffer, (int32_t *) converted, frames * r->fmt->channels);
+    }
+    else if (r->input == RG_INPUT_BIGENDIAN) {
+        rg_unpack_be ((const uint8_t *) buffer, (int32_t *) converted, frames * r->fmt->channels, r->fmt->bps / 8);
+    }
+    else if (r->input == RG_INPUT_CONVERT) {
+        ddb_waveformat_t fmt;
+        memcpy (&fmt, r->fmt, sizeof (fmt));
+        fmt.bps = 32;
+        fmt.is_float = 1;
+        fmt.is_bigendian = 0;
+        deadbeef->pcm_convert (r->fmt, buffer, &fmt, converted, sz);
+    }
+
+    if (r->warmup > 0) {
+        r->warmup -= frames;
+        *warmup_end = r->warmup == 0;
+    }
+    else if (r->left > 0) {
+        r->left -= frames;
+    }
+    return frames;
+}
+
+/* feeds a block read by rg_read_block to libebur128 */
+static void rg_add_block (struct rg_reader *r, ebur128_state *status, const char *buffer, const char *converted, int frames)
+{
+    switch (r->input) {
+    case RG_INPUT_SHORT:
+        ebur128_add_frames_short (status, (const short *) buffer, frames);
+        break;
+    case RG_INPUT_INT:
+        ebur128_add_frames_int (status, (const int *) buffer, frames);
+        break;
+    case RG_INPUT_FLOAT:
+        ebur128_add_frames_float (status, (const float *) buffer, frames);
+        break;
+    case RG_INPUT_INT24:
+    case RG_INPUT_BIGENDIAN:
+        ebur128_add_frames_int (status, (const int *) converted, frames);
+        break;
+    default:
+        ebur128_add_frames_float (status, (const float *) converted, frames);
+        break;
+    }
+}
+
+/*
+ * Bounded single-producer/single-consumer queue of decoded blocks, used to
+ * run decoding and loudness analysis of a work item on two threads. head is
+ * only written by the decoding thread and tail only by the analysing one,
+ * so a block is handed over without taking a lock. A stage that finds the
+ * ring full or empty sleeps on cond until the other one has moved on.
+ */
+#define RG_RING_SLOTS 8
+
+struct rg_ring_slot
+{
+    char *data;                     /* decoder output */
+    size_t size;
+    char *converted;                /* see rg_read_block */
+    size_t converted_size;
+    int frames;
+    int warmup_end;                 /* see rg_read_block */
+};
+
+struct rg_ring
+{
+    struct rg_ring_slot slots[RG_RING_SLOTS];
+    unsigned int head;              /* number of blocks published by the decoder */
+    unsigned int tail;              /* number of blocks consumed by the analysis */
+    int done;                       /* the decoder has published its last block */
+    int stop;                       /* the analysis wants the decoder to stop early */
+    uintptr_t mutex;                /* held to wait on cond and to signal it */
+    uintptr_t cond;                 /* signalled when head, tail, done or stop change */
+    struct rg_reader *reader;
+    unsigned long decode_stalls;    /* times the decoder had to wait for a free slot */
+    unsigned long analysis_stalls;  /* times the analysis had to wait for a block */
+};
+
+/* wakes up the other stage after head, tail, done or stop was stored */
+static void rg_ring_signal (struct rg_ring *ring)
+{
+    deadbeef->mutex_lock (ring->mutex);
+    deadbeef->cond_signal (ring->cond);
+    deadbeef->mutex_unlock (ring->mutex);
+}
+
+static void rg_decode_thread (void *ctx)
+{
+    struct rg_ring *ring = ctx;
+    int stalled = 0;
+
+    for (;;) {
+        if (__atomic_load_n (&ring->stop, __ATOMIC_ACQUIRE) || (ring->reader->abort && *ring->reader->abort)) {
+            break;
+        }
+        unsigned int head = ring->head;
+        if (head - __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE) == RG_RING_SLOTS) {
+            // analysis is behind, wait for it to free a slot
+            if (!stalled) {
+                ring->decode_stalls++;
+                stalled = 1;
+            }
+            deadbeef->mutex_lock (ring->mutex);
+            if (head - __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE) == RG_RING_SLOTS
+                && !__atomic_load_n (&ring->stop, __ATOMIC_ACQUIRE)) {
+                deadbeef->cond_wait (ring->cond, ring->mutex);
+            }
+            deadbeef->mutex_unlock (ring->mutex);
+            continue;
+        }
+        stalled = 0;
+
+        struct rg_ring_slot *slot = &ring->slots[head % RG_RING_SLOTS];
+        slot->frames = rg_read_block (ring->reader, slot->data, slot->converted, &slot->warmup_end);
+        __atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+        rg_ring_signal (ring);
+        if (ring->reader->eof) {
+            break;
+        }
+    }
+    __atomic_store_n (&ring->done, 1, __ATOMIC_RELEASE);
+    rg_ring_signal (ring);
+}
+
+/* decodes the item on a separate thread while analysing the blocks it produces */
+static int rg_analyse_pipelined (struct rg_worker *worker, struct rg_reader *reader, ebur128_state *status)
+{
+    if (!worker->ring) {
+        worker->ring = calloc (1, sizeof (struct rg_ring));
+        if (!worker->ring) {
+            fprintf (stderr, "rg scan: failed to allocate decoding buffers\n");
+            return -1;
+        }
+        worker->ring->mutex = deadbeef->mutex_create ();
+        worker->ring->cond = deadbeef->cond_create ();
+    }
+    struct rg_ring *ring = worker->ring;
+    for (int i = 0; i < RG_RING_SLOTS; ++i) {
+        if (rg_reserve (&ring->slots[i].data, &ring->slots[i].size, reader->bs) < 0
+            || rg_reserve (&ring->slots[i].converted, &ring->slots[i].converted_size, rg_converted_size (reader)) < 0) {
+            fprintf (stderr, "rg scan: failed to allocate decoding buffers\n");
+            return -1;
+        }
+    }
+    ring->head = 0;
+    ring->tail = 0;
+    ring->done = 0;
+    ring->stop = 0;
+    ring->reader = reader;
+
+    intptr_t tid = deadbeef->thread_start (&rg_decode_thread, ring);
+    int stalled = 0;
+
+    for (;;) {
+        if (reader->abort && *reader->abort) {
+            fprintf (stdout, "rg scan: user asked to abort, scanning aborted.\n");
+            __atomic_store_n (&ring->stop, 1, __ATOMIC_RELEASE);
+            rg_ring_signal (ring);
+            break;
+        }
+        unsigned int tail = ring->tail;
+        if (tail == __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE)) {
+            // done has to be checked before head, the last block may have been published in between
+            if (__atomic_load_n (&ring->done, __ATOMIC_ACQUIRE) && tail == __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            // decoder is behind, wait for the next block
+            if (!stalled) {
+                ring->analysis_stalls++;
+                stalled = 1;
+            }
+            deadbeef->mutex_lock (ring->mutex);
+            if (tail == __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE)
+                && !__atomic_load_n (&ring->done, __ATOMIC_ACQUIRE)) {
+                deadbeef->cond_wait (ring->cond, ring->mutex);
+            }
+            deadbeef->mutex_unlock (ring->mutex);
+            continue;
+        }
+        stalled = 0;
+
+        struct rg_ring_slot *slot = &ring->slots[tail % RG_RING_SLOTS];
+        rg_add_block (reader, status, slot->data, slot->converted, slot->frames);
+        if (slot->warmup_end) {
+            // the filter has settled, blocks measured so far belong to the previous segment
+            ebur128_discard_measurements (status);
+        }
+        __atomic_store_n (&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        rg_ring_signal (ring);
+    }
+
+    deadbeef->thread_join (tid);
+    return 0;
+}
+
+/*
+ * takes a state from the worker's pool, preferring one with the same format
+ * so it can be reset without reallocating anything, or creates a new one
+ */
+static ebur128_state *rg_state_get (struct rg_worker *worker, unsigned int channels, unsigned long samplerate)
+{
+    int pick = -1;
+    for (int i = 0; i < worker->pool_size; ++i) {
+        if (worker->pool[i]->channels == channels && worker->pool[i]->samplerate == samplerate) {
+            pick = i;
+            break;
+        }
+    }
+    if (pick < 0 && worker->pool_size > 0) {
+        pick = worker->pool_size - 1;
+    }
+    if (pick >= 0) {
+        ebur128_state *status = worker->pool[pick];
+        worker->pool[pick] = worker->pool[--worker->pool_size];
+        if (ebur128_reset (status, channels, samplerate) == EBUR128_SUCCESS) {
+            return status;
+        }
+        ebur128_destroy (&status);
+    }
+    return ebur128_init(channels,                                // channels
+                        samplerate,                              // samplerate
+                        EBUR128_MODE_I |                         // mode: Integrated (over the length of the track)
+                        EBUR128_MODE_SAMPLE_PEAK |               // and find sample peak
+                        worker->job->ebur128_mode);              // optional single precision filtering and true peak
+}
+
+/* returns a state to the worker's pool, or destroys it if the pool is full */
+static void rg_state_put (struct rg_worker *worker, ebur128_state *status)
+{
+    if (worker->pool_size < RG_POOL_STATES) {
+        worker->pool[worker->pool_size++] = status;
+    }
+    else {
+        ebur128_destroy (&status);
+    }
+}
+
+/*
+ * Approximate 95% bound in dB of the loudness of a track estimated from its
+ * windows. The loudness of the windows varies around that of the track, so
+ * the bound follows from the standard error of their mean, which shrinks as
+ * the windows cover more of the track. Silent windows are left out, like
+ * gating leaves them out of the loudness. The bound is at least 0.01 dB, the
+ * precision of the tags, and 30 dB if too few windows had sound to tell.
+ */
+static float rg_sampling_error (ebur128_state **status, int num_windows, double coverage)
+{
+    // 97.5% quantiles of Student's t for 1 to 19 degrees of freedom, the normal one beyond
+    static const double t[] = { 12.71, 4.30, 3.18, 2.78, 2.57, 2.45, 2.36, 2.31, 2.26, 2.23,
+                                2.20, 2.18, 2.16, 2.14, 2.13, 2.12, 2.11, 2.10, 2.09 };
+    double sum = 0, sum_sq = 0;
+    int n = 0;
+    for (int i = 0; i < num_windows; ++i) {
+        double loudness;
+        if (!status[i] || ebur128_loudness_global (status[i], &loudness) != EBUR128_SUCCESS
+            || loudness == -HUGE_VAL) {
+            continue;
+        }
+        sum += loudness;
+        sum_sq += loudness * loudness;
+        n++;
+    }
+    if (n < 2) {
+        return 30;
+    }
+    double mean = sum / n;
+    double variance = (sum_sq - n * mean * mean) / (n - 1);
+    double quantile = n - 2 < (int) (sizeof (t) / sizeof (t[0])) ? t[n - 2] : 1.96;
+    double error = variance > 0 && coverage < 1 ? quantile * sqrt (variance / n * (1 - coverage)) : 0;
+    return error > 0.01 ? (float) error : 0.01f;
+}
+
+/*
+ * adds the blocks of a sampled track to the album as if the whole track had
+ * been measured, so it weighs as much as a track that was scanned completely
+ */
+static void rg_add_scaled_summary (ebur128_summary *album, const ebur128_summary *track, double scale)
+{
+    for (int i = 0; i < 1000; ++i) {
+        album->blocks[i] += (unsigned long) (track->blocks[i] * scale + 0.5);
+        album->energy[i] += track->energy[i] * scale;
+    }
+}
+
+/* calculates gain and peak of a track once all of its segments have been scanned */
+static void rg_finish_track (struct rg_worker *worker, int track)
+{
+    struct rg_scan_job *job = worker->job;
+    struct rg_work_item *work = &job->items[job->first_item[track]];
+    ebur128_state **status = &job->status[job->first_item[track]];
+    int num_segments = work->num_segments;
+
+    /*
+     * the gain of the segments which did scan would be that of a part of the
+     * track, so the track gets no gain and is left out of the album, as if
+     * it had failed to scan in one piece
+     */
+    if (job->failed[track]) {
+        deadbeef->pl_lock ();
+        fprintf (stderr, "rg scan: %s could not be scanned completely, no gain calculated\n",
+                 deadbeef->pl_find_meta (job->scan_items[track], ":URI"));
+        deadbeef->pl_unlock ();
+        if (job->out_track_err) {
+            job->out_track_err[track] = -1;
+        }
+        for (int seg = 0; seg < num_segments; ++seg) {
+            if (status[seg]) {
+                rg_state_put (worker, status[seg]);
+                status[seg] = NULL;
+            }
+        }
+        return;
+    }
+
+    // calculating track peak
+    // libEBUR128 calculates peak per channel, so we have to pick the highest value
+    int true_peak = (job->ebur128_mode & EBUR128_MODE_TRUE_PEAK) == EBUR128_MODE_TRUE_PEAK;
+    double tr_peak = 0;
+    double ch_peak = 0;
+    int res;
+    // the peak of a few windows is not the peak of the track, and too low to prevent clipping
+    for (int seg = 0; seg < num_segments && !work->sampled; ++seg)
+    {
+        for (unsigned int ch = 0; ch < status[seg]->channels; ++ch)
+        {
+            if (true_peak) {
+                res = ebur128_true_peak(status[seg], ch, &ch_peak);
+            }
+            else {
+                res = ebur128_sample_peak(status[seg], ch, &ch_peak);
+            }
+            if (res == EBUR128_ERROR_INVALID_MODE){
+                fprintf (stderr, "rg scan: internal error: invalid mode set\n");
+                *job->abort = 1;
+                return;
+            }
+            trace ("rg scan: peak for ch %d: %f\n", ch, ch_peak);
+            if (ch_peak > tr_peak){
+                trace ("rg scan: %f > %f\n", ch_peak, tr_peak);
+                tr_peak = ch_peak;
+            }
+        }
+    }
+    job->out_track_pk[track] = work->sampled ? -1 : (float) tr_peak;
+
+    // calculate track loudness, the gating blocks of all segments together are those of the whole track
     double loudness;
+    ebur128_loudness_global_multiple(status, (size_t) num_segments, &loudness);
+    /*
+     * EBUR128 sets the target level to -23 LUFS = 84dB
+     * -> -23 - loudness = track gain to get to 84dB
+     *
+     * The old implementation of RG used 89dB, most people still use that
+     * -> the above + (targetdb - 84) = track gain to get to 89dB (or user specified)
+     */
+    job->out_track_rg[track] = (float) (-23 - loudness + *job->targetdb - 84);
+
+    // windows cover this part of a sampled track
+    double coverage = 1;
+    if (work->sampled) {
+        float duration = deadbeef->pl_get_item_duration (job->scan_items[track]);
+        coverage = num_segments * RG_QUICK_WINDOW_BLOCKS / 10.0 / duration;
+    }
+    if (job->out_track_err) {
+        job->out_track_err[track] = work->sampled ? rg_sampling_error (status, num_segments, coverage) : 0;
+    }
+
+    // only the gating blocks are needed for album gain, so memory doesn't grow with the number of tracks
+    if (work->sampled) {
+        ebur128_summary *sampled = calloc (1, sizeof (ebur128_summary));
+        if (sampled) {
+            for (int seg = 0; seg < num_segments; ++seg) {
+                if (status[seg]) {
+                    ebur128_add_to_summary (status[seg], sampled);
+                }
+            }
+            deadbeef->mutex_lock (job->mutex);
+            rg_add_scaled_summary (&job->album, sampled, 1 / coverage);
+            deadbeef->mutex_unlock (job->mutex);
+            free (sampled);
+        }
+    }
+    else {
+        deadbeef->mutex_lock (job->mutex);
+        for (int seg = 0; seg < num_segments; ++seg) {
+            if (status[seg]) {
+                ebur128_add_to_summary (status[seg], &job->album);
+            }
+        }
+        deadbeef->mutex_unlock (job->mutex);
+    }
+    for (int seg = 0; seg < num_segments; ++seg) {
+        if (status[seg]) {
+            rg_state_put (worker, status[seg]);
+            status[seg] = NULL;
+        }
+    }
+}
+
+/*
+ * pseudo-random offset of a window into its share of the track, in
+ * [0, range), the same for every scan of the track
+ */
+static int64_t rg_window_offset (const struct rg_work_item *work, int64_t range)
+{
+    uint32_t h = (uint32_t) (work->segment + 1) * 2654435761u ^ (uint32_t) range;
+    h ^= h >> 15;
+    h *= 2246822519u;
+    h ^= h >> 13;
+    h *= 3266489917u;
+    h ^= h >> 16;
+    return range > 0 ? (int64_t) (h / 4294967296.0 * range) : 0;
+}
+
+/* the worker's read size tuning of a decoder, NULL once too many were seen */
+static struct rg_read_tuning *rg_read_tuning (struct rg_worker *worker, DB_decoder_t *dec)
+{
+    for (int i = 0; i < worker->num_tunings; ++i) {
+        if (worker->tuning[i].dec == dec) {
+            return &worker->tuning[i];
+        }
+    }
+    if (worker->num_tunings == RG_TUNED_DECODERS) {
+        return NULL;
+    }
+    struct rg_read_tuning *t = &worker->tuning[worker->num_tunings++];
+    memset (t, 0, sizeof (*t));
+    t->dec = dec;
+    t->frames = RG_READ_FRAMES_DEFAULT;
+    return t;
+}
+
+/* frames to read at once from a decoder */
+static int rg_read_frames (struct rg_worker *worker, DB_decoder_t *dec)
+{
+    if (worker->job->read_frames > 0) {
+        return worker->job->read_frames;
+    }
+    struct rg_read_tuning *t = rg_read_tuning (worker, dec);
+    if (!t) {
+        return RG_READ_FRAMES_DEFAULT;
+    }
+    return t->trial < RG_READ_SIZES ? rg_read_sizes[t->trial] : t->frames;
+}
+
+/*
+ * records how fast an item was scanned with the size being tried. Items too
+ * short for a few reads say more about opening and seeking than reading, so
+ * they only move on to the next size, which keeps short items, e.g. the
+ * windows of a quick scan, from being stuck with the largest one.
+ */
+static void rg_tune_read_frames (struct rg_worker *worker, DB_decoder_t *dec, int frames, int64_t decoded, double seconds)
+{
+    if (worker->job->read_frames > 0) {
+        return;
+    }
+    struct rg_read_tuning *t = rg_read_tuning (worker, dec);
+    if (!t || t->trial == RG_READ_SIZES || rg_read_sizes[t->trial] != frames) {
+        return;
+    }
+    double rate = seconds > 0 ? decoded / seconds : 0;
+    if (decoded >= 4 * (int64_t) frames && rate > t->rate) {
+        t->rate = rate;
+        t->frames = frames;
+    }
+    if (++t->trial == RG_READ_SIZES) {
+        trace ("rg scan: worker %d reads %d frames at once from %s\n", worker->worker_id, t->frames, dec ? dec->plugin.id : "files read directly");
+    }
+}
+
+/*
+ * A decoder opened on a track for one work item, or an uncompressed file
+ * whose samples are read directly. rg_session_close frees the decoder or
+ * closes the file and gives its place in the budget of open files back, it
+ * has to be called whether rg_session_open succeeded or not.
+ */
+struct rg_session
+{
+    DB_decoder_t *dec;
+    DB_fileinfo_t *fileinfo;
+    ddb_waveformat_t fmt;           /* format of the samples read */
+    int fd;                         /* file read directly, -1 if decoding */
+    int64_t data;                   /* offset of the first frame in the file */
+    int64_t frames;                 /* frames in the file */
+    int counted;                    /* counts towards job->open_files */
 };
 
-void rg_calc_thread(void* _args)
+/* scanning needs neither 16-bit output, bitrate updates nor looping */
+#define RG_DECODER_HINTS 0
+
+static uint32_t rg_le16 (const uint8_t *p) { return p[0] | p[1] << 8; }
+static uint32_t rg_le32 (const uint8_t *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24; }
+static uint32_t rg_be16 (const uint8_t *p) { return p[0] << 8 | p[1]; }
+static uint32_t rg_be32 (const uint8_t *p) { return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+/*
+ * finds the samples of a plain PCM or float WAV file from the first size
+ * bytes of it, returns the offset of the data chunk and fills in fmt and its
+ * size, or -1 for anything else
+ */
+static int64_t rg_parse_wav (const uint8_t *file, size_t size, int64_t file_size, ddb_waveformat_t *fmt, int64_t *data_size)
+{
+    if (size < 12 || memcmp (file, "RIFF", 4) || memcmp (file + 8, "WAVE", 4)) {
+        return -1;
+    }
+    int have_fmt = 0;
+    for (size_t pos = 12; pos + 8 <= size; ) {
+        const uint8_t *chunk = file + pos;
+        uint32_t len = rg_le32 (chunk + 4);
+        if (!memcmp (chunk, "fmt ", 4) && len >= 16 && pos + 8 + len <= size) {
+            uint32_t tag = rg_le16 (chunk + 8);
+            if (tag == 0xfffe && len >= 40) {
+                tag = rg_le16 (chunk + 32); // WAVE_FORMAT_EXTENSIBLE, the sub format GUID starts with the tag
+            }
+            fmt->channels = (int) rg_le16 (chunk + 10);
+            fmt->samplerate = (int) rg_le32 (chunk + 12);
+            fmt->bps = (int) rg_le16 (chunk + 22);
+            fmt->is_float = tag == 3;
+            fmt->is_bigendian = 0;
+            if ((tag != 1 && tag != 3) || (int) rg_le16 (chunk + 20) != fmt->channels * fmt->bps / 8) {
+                return -1;
+            }
+            have_fmt = 1;
+        }
+        else if (!memcmp (chunk, "data", 4)) {
+            if (!have_fmt) {
+                return -1;
+            }
+            // files written while streaming may not have the size filled in
+            int64_t rest = file_size - (int64_t) pos - 8;
+            *data_size = len == 0 || len == 0xffffffff || len > rest ? rest : len;
+            return (int64_t) pos + 8;
+        }
+        pos += 8 + (size_t) len + (len & 1);
+    }
+    return -1;
+}
+
+/* same for an AIFF file, or an AIFF-C one with uncompressed samples */
+static int64_t rg_parse_aiff (const uint8_t *file, size_t size, int64_t file_size, ddb_waveformat_t *fmt, int64_t *data_size)
+{
+    if (size < 12 || memcmp (file, "FORM", 4) || (memcmp (file + 8, "AIFF", 4) && memcmp (file + 8, "AIFC", 4))) {
+        return -1;
+    }
+    int aifc = !memcmp (file + 8, "AIFC", 4);
+    int have_comm = 0;
+    int64_t frames = 0;
+    for (size_t pos = 12; pos + 8 <= size; ) {
+        const uint8_t *chunk = file + pos;
+        uint32_t len = rg_be32 (chunk + 4);
+        if ((int64_t) pos + 8 + len > file_size) {
+            return -1;
+        }
+        if (!memcmp (chunk, "COMM", 4) && len >= (aifc ? 22u : 18u) && pos + 8 + len <= size) {
+            fmt->channels = (int) rg_be16 (chunk + 8);
+            frames = rg_be32 (chunk + 10);
+            fmt->bps = (int) rg_be16 (chunk + 14);
+            // the rate is an 80-bit extended float
+            int exponent = (int) (rg_be16 (chunk + 16) & 0x7fff) - 16383 - 31;
+            double rate = ldexp ((double) rg_be32 (chunk + 18), exponent);
+            fmt->samplerate = (int) (rate + 0.5);
+            fmt->is_float = 0;
+            fmt->is_bigendian = 1;
+            if (aifc && !memcmp (chunk + 26, "sowt", 4)) {
+                fmt->is_bigendian = 0;
+            }
+            else if (aifc && memcmp (chunk + 26, "NONE", 4) && memcmp (chunk + 26, "twos", 4)) {
+                return -1;
+            }
+            have_comm = 1;
+        }
+        else if (!memcmp (chunk, "SSND", 4) && len >= 8 && pos + 16 <= size) {
+            if (!have_comm) {
+                return -1;
+            }
+            uint32_t offset = rg_be32 (chunk + 8);
+            if (offset > len - 8) {
+                return -1;
+            }
+            *data_size = len - 8 - offset;
+            if (*data_size > frames * fmt->channels * (fmt->bps / 8)) {
+                *data_size = frames * fmt->channels * (fmt->bps / 8);
+            }
+            return (int64_t) pos + 16 + offset;
+        }
+        pos += 8 + (size_t) len + (len & 1);
+    }
+    return -1;
+}
+
+/* chunks before the samples have to be in this many bytes at the start of a file */
+#define RG_PCM_HEADER (64 << 10)
+
+/*
+ * Uncompressed WAV and AIFF files are read straight into the worker's
+ * buffers instead of through the decoder, which saves the decoder's read
+ * loop and its copies, so scanning a 24/96 archive is limited by the disk
+ * rather than by copying. Reads use pread, a file truncated during the scan
+ * just ends early. Subtracks, compressed or 8-bit samples and anything else
+ * the parsers don't know are left to the decoder.
+ */
+static int rg_session_direct (struct rg_session *session, DB_playItem_t *item)
+{
+    char path[PATH_MAX];
+    if (deadbeef->pl_get_item_flags (item) & DDB_IS_SUBTRACK || rg_local_path (item, path, sizeof (path)) != 0) {
+        return -1;
+    }
+    int fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    uint8_t *header = malloc (RG_PCM_HEADER);
+    ssize_t size = -1;
+    if (header && fstat (fd, &st) == 0 && S_ISREG (st.st_mode)) {
+        size = pread (fd, header, RG_PCM_HEADER, 0);
+    }
+
+    ddb_waveformat_t fmt;
+    memset (&fmt, 0, sizeof (fmt));
+    int64_t data_size = 0;
+    int64_t offset = -1;
+    if (size >= 12) {
+        offset = rg_parse_wav (header, (size_t) size, st.st_size, &fmt, &data_size);
+        if (offset < 0) {
+            offset = rg_parse_aiff (header, (size_t) size, st.st_size, &fmt, &data_size);
+        }
+    }
+    free (header);
+
+    int width = fmt.bps / 8;
+    if (offset < 0 || fmt.channels <= 0 || fmt.samplerate <= 0 || data_size < fmt.channels * width
+        || rg_input_format (&fmt) == RG_INPUT_CONVERT) {
+        close (fd);
+        return -1;
+    }
+
+    posix_fadvise (fd, offset, data_size, POSIX_FADV_SEQUENTIAL);
+    session->fd = fd;
+    session->data = offset;
+    session->frames = data_size / (fmt.channels * width);
+    session->fmt = fmt;
+    return 0;
+}
+
+static int rg_session_open (struct rg_scan_job *job, struct rg_session *session, DB_playItem_t *item)
+{
+    memset (session, 0, sizeof (*session));
+    session->fd = -1;
+
+    deadbeef->pl_lock ();
+    session->dec = (DB_decoder_t *)deadbeef->plug_get_for_id (deadbeef->pl_find_meta (item, ":DECODER"));
+    deadbeef->pl_unlock ();
+    if (!session->dec) {
+        deadbeef->pl_lock ();
+        fprintf (stderr, "rg scan: could not open a decoder for %s\n", deadbeef->pl_find_meta (item, ":URI"));
+        deadbeef->pl_unlock ();
+        return -1;
+    }
+
+    // wait for another worker to free its decoder if the budget is used up
+    deadbeef->mutex_lock (job->mutex);
+    int waited = 0;
+    while (job->files_cond && job->open_files >= job->max_open_files) {
+        waited = 1;
+        deadbeef->cond_wait (job->files_cond, job->mutex);
+    }
+    job->file_waits += waited;
+    if (++job->open_files > job->peak_open_files) {
+        job->peak_open_files = job->open_files;
+    }
+    session->counted = 1;
+    deadbeef->mutex_unlock (job->mutex);
+
+    if (job->direct_pcm && rg_session_direct (session, item) == 0) {
+        return 0;
+    }
+
+    session->fileinfo = session->dec->open (RG_DECODER_HINTS);
+    if (!session->fileinfo) {
+        deadbeef->pl_lock ();
+        fprintf (stderr, "rg scan: could not open a decoder for %s\n", deadbeef->pl_find_meta (item, ":URI"));
+        deadbeef->pl_unlock ();
+        return -1;
+    }
+    if (session->dec->init (session->fileinfo, DB_PLAYITEM (item)) != 0) {
+        deadbeef->pl_lock ();
+        fprintf (stderr, "rg scan: failed to decode file %s\n", deadbeef->pl_find_meta (item, ":URI"));
+        deadbeef->pl_unlock ();
+        return -1;
+    }
+    session->fmt = session->fileinfo->fmt;
+    return 0;
+}
+
+static void rg_session_close (struct rg_scan_job *job, struct rg_session *session)
+{
+    if (session->fileinfo) {
+        session->dec->free (session->fileinfo);
+        session->fileinfo = NULL;
+    }
+    if (session->fd >= 0) {
+        close (session->fd);
+        session->fd = -1;
+    }
+    if (session->counted) {
+        deadbeef->mutex_lock (job->mutex);
+        job->open_files--;
+        if (job->files_cond) {
+            deadbeef->cond_signal (job->files_cond);
+        }
+        deadbeef->mutex_unlock (job->mutex);
+        session->counted = 0;
+    }
+}
+
+/* scans a work item with an open decoder */
+static int rg_calc_session (struct rg_worker *worker, int index, struct rg_session *session)
 {
-    if(!_args)
+    struct rg_scan_job *job = worker->job;
+    struct rg_work_item *work = &job->items[index];
+    DB_playItem_t *item = job->scan_items[work->track];
+    DB_decoder_t *dec = session->dec;
+    const ddb_waveformat_t *fmt = &session->fmt;
+    // read sizes for files read directly are tuned as if they were one more decoder
+    DB_decoder_t *tuned = session->fd >= 0 ? NULL : dec;
+
+    // this is a status object for ebur128 gain and peak scanning, both are measured in a single pass
+    ebur128_state *status = rg_state_get (worker, fmt->channels, fmt->samplerate);
+    // the state is owned by the job from now on, so album gain can be calculated later
+    job->status[index] = status;
+    if(status == NULL)
     {
-        /* should not happen */
-        return;
+        deadbeef->pl_lock ();
+        fprintf (stderr, "rg scan: failed to init libebur128 object for file %s, aborting\n", deadbeef->pl_find_meta (item, ":URI"));
+        deadbeef->pl_unlock ();
+        return -1;
     }
 
-    char *buffer = NULL;
-    char *bufferf = NULL;
-    ddb_waveformat_t fmt;
+    // setting channel map
+    switch(fmt->channels)
+    {
+        case 1: // mono
+            ebur128_set_channel (status, 0, EBUR128_CENTER);
+            break;
+        case 2: // stereo
+            ebur128_set_channel (status, 0, EBUR128_LEFT);
+            ebur128_set_channel (status, 1, EBUR128_RIGHT);
+            break;
+        case 3: // 3.1
+            ebur128_set_channel(status, 0, EBUR128_LEFT);
+            ebur128_set_channel(status, 1, EBUR128_RIGHT);
+            ebur128_set_channel(status, 2, EBUR128_CENTER);
+            break;
+        case 4:
+            ebur128_set_channel(status, 0, EBUR128_LEFT);
+            ebur128_set_channel(status, 1, EBUR128_RIGHT);
+            ebur128_set_channel(status, 2, EBUR128_LEFT_SURROUND);
+            ebur128_set_channel(status, 3, EBUR128_RIGHT_SURROUND);
+            break;
+        case 5:
+            ebur128_set_channel(status, 0, EBUR128_LEFT);
+            ebur128_set_channel(status, 1, EBUR128_RIGHT);
+            ebur128_set_channel(status, 2, EBUR128_CENTER);
+            ebur128_set_channel(status, 3, EBUR128_LEFT_SURROUND);
+            ebur128_set_channel(status, 4, EBUR128_RIGHT_SURROUND);
+            break;
+        case 6:
+            ebur128_set_channel(status, 0, EBUR128_LEFT);
+            ebur128_set_channel(status, 1, EBUR128_RIGHT);
+            ebur128_set_channel(status, 2, EBUR128_CENTER);
+            // LFE is not being taken into account when scanning
+            // see R128 spec at https://tech.ebu.ch/docs/tech/tech3341.pdf
+            ebur128_set_channel(status, 3, EBUR128_UNUSED);
+            ebur128_set_channel(status, 4, EBUR128_LEFT_SURROUND);
+            ebur128_set_channel(status, 5, EBUR128_RIGHT_SURROUND);
+            break;
+        default:
+            deadbeef->pl_lock ();
+            fprintf (stderr, "rg scan: file %s has %d channels - libebur128 only supports up to 6. Aborting.\n",
+                             deadbeef->pl_find_meta (item, ":URI"),
+                             fmt->channels);
+            deadbeef->pl_unlock ();
+            return -1;
+    }
 
-    struct rg_thread_arg* args = (struct rg_thread_arg*)_args;
-    if (args->abort && *args->abort) {
-        fprintf (stdout, "rg scan: user asked to abort, main loop aborted.\n");
-        args->result = -2;
-        return;
+    struct rg_reader reader;
+    memset (&reader, 0, sizeof (reader));
+    reader.dec = dec;
+    reader.fileinfo = session->fileinfo;
+    reader.fmt = fmt;
+    reader.fd = session->fd;
+    reader.data = session->data;
+    reader.frames = session->frames;
+    reader.abort = job->abort;
+    reader.samplesize = fmt->channels * fmt->bps / 8;
+    reader.input = rg_input_format (fmt);
+
+    int read_frames = rg_read_frames (worker, tuned);
+    reader.bs = read_frames * reader.samplesize;
+
+    // the buffers are kept by the worker and only grow if a track needs more
+    if (rg_reserve (&worker->buffer, &worker->buffer_size, reader.bs) < 0
+        || rg_reserve (&worker->converted, &worker->converted_size, rg_converted_size (&reader)) < 0) {
+        fprintf (stderr, "rg scan: failed to allocate decoding buffers\n");
+        return -1;
     }
-    if (deadbeef->pl_get_item_duration (args->scan_items[args->thread_id]) <= 0) {
+
+    /*
+     * find the part of the track covered by this item, segment boundaries are
+     * aligned to the 100ms blocks libebur128 measures (using the same rounding)
+     */
+    int64_t block = (fmt->samplerate + 5) / 10;
+    int64_t segment_frames = (int64_t) (job->segment_length * fmt->samplerate) / block * block;
+    int64_t start = work->segment * segment_frames;
+    reader.warmup = work->segment > 0 ? RG_WARMUP_BLOCKS * block : 0;
+    reader.left = work->segment < work->num_segments - 1 ? segment_frames : -1; // -1: until the end of the track
+    if (work->sampled) {
+        /*
+         * each window is somewhere in its share of the track, evenly spaced
+         * windows could all hit the same part of a repeating pattern
+         */
+        int64_t total = (int64_t) (deadbeef->pl_get_item_duration (item) * fmt->samplerate);
+        int64_t share = total / work->num_segments;
+        reader.left = RG_QUICK_WINDOW_BLOCKS * block;
+        start = (work->segment * share + rg_window_offset (work, share - reader.left)) / block * block;
+        reader.warmup = start < RG_WARMUP_BLOCKS * block ? start : RG_WARMUP_BLOCKS * block;
+    }
+    int seek_failed = 0;
+    if (reader.fd >= 0) {
+        reader.pos = start - reader.warmup;
+        seek_failed = reader.pos >= reader.frames;
+    }
+    else if (start > 0) {
+        seek_failed = dec->seek_sample (session->fileinfo, (int) (start - reader.warmup)) != 0;
+    }
+    if (seek_failed) {
         deadbeef->pl_lock ();
-        fprintf (stderr, "rg scan: stream %s doesn't have finite length, skipped\n", deadbeef->pl_find_meta (args->scan_items[args->thread_id], ":URI"));
+        fprintf (stderr, "rg scan: failed to seek in file %s\n", deadbeef->pl_find_meta (item, ":URI"));
         deadbeef->pl_unlock ();
-        args->result = -1;
-        return;
+        return -1;
     }
 
-    DB_decoder_t *dec = NULL;
-    DB_fileinfo_t *fileinfo = NULL;
+    double start_time = rg_now ();
+    // there is no decoding to overlap with the analysis of samples read directly
+    if (job->pipeline && reader.fd < 0) {
+        int res = rg_analyse_pipelined (worker, &reader, status);
+        rg_tune_read_frames (worker, tuned, read_frames, reader.decoded, rg_now () - start_time);
+        return res;
+    }
 
-    deadbeef->pl_lock ();
-    dec = (DB_decoder_t *)deadbeef->plug_get_for_id (deadbeef->pl_find_meta (args->scan_items[args->thread_id], ":DECODER"));
-    deadbeef->pl_unlock ();
+    for (;;) {
+        if (job->abort && *job->abort) {
+            fprintf (stdout, "rg scan: user asked to abort, scanning aborted.\n");
+            break;
+        }
 
+        int warmup_end;
+        int frames = rg_read_block (&reader, worker->buffer, worker->converted, &warmup_end);
 
-    if (dec) { // we have our decoder
-        fileinfo = dec->open (0);
-        if (fileinfo && dec->init (fileinfo, DB_PLAYITEM (args->scan_items[args->thread_id])) != 0) {
-            deadbeef->pl_lock ();
-            fprintf (stderr, "rg scan: failed to decode file %s\n", deadbeef->pl_find_meta (args->scan_items[args->thread_id], ":URI"));
-            deadbeef->pl_unlock ();
-            args->result = -1;
-            return;
-        }
-
-        if (fileinfo) { // we have all info needed to scan
-            // this is a status object for ebur128 gain scanning
-            args->status_gain[args->thread_id] = ebur128_init(fileinfo->fmt.channels,   // channels
-                                          fileinfo->fmt.samplerate, // samplerate
-                                          EBUR128_MODE_I);          // mode: Integrated (over the length of the track)
-
-            // this is a status object for ebur128 peak scanning - needs a different mode, so separate
-            args->status_peak[args->thread_id] = ebur128_init(fileinfo->fmt.channels,   // channels
-                                          fileinfo->fmt.samplerate, // samplerate
-                                          EBUR128_MODE_SAMPLE_PEAK);// mode: find sample peak
-            if(args->status_gain[args->thread_id] == NULL || args->status_peak[args->thread_id] == NULL)
-            {
-                deadbeef->pl_lock ();
-                fprintf (stderr, "rg scan: failed to init libebur128 object for file %s, aborting\n", deadbeef->pl_find_meta (args->scan_items[args->thread_id], ":URI"));
-                deadbeef->pl_unlock ();
-                args->result = -1;
-                return;
-            }
+        rg_add_block (&reader, status, worker->buffer, worker->converted, frames);
 
-            // setting channel map
-            switch(fileinfo->fmt.channels)
-            {
-                case 1: // mono
-                    ebur128_set_channel (args->status_gain[args->thread_id], 0, EBUR128_CENTER);
+        if (warmup_end) {
+            // the filter has settled, blocks measured so far belong to the previous segment
+            ebur128_discard_measurements (status);
+        }
+        if (reader.eof) {
+            break;
+        }
+    }
+    if (reader.error) {
+        // the gain of what could be read would be that of a part of the track
+        deadbeef->pl_lock ();
+        fprintf (stderr, "rg scan: failed to read file %s: %s\n", deadbeef->pl_find_meta (item, ":URI"), strerror (reader.error));
+        deadbeef->pl_unlock ();
+        return -1;
+    }
 
-                    ebur128_set_channel (args->status_peak[args->thread_id], 0, EBUR128_CENTER);
-                    break;
-                case 2: // stereo
-                    ebur128_set_channel (args->status_gain[args->thread_id], 0, EBUR128_LEFT);
-                    ebur128_set_channel (args->status_gain[args->thread_id], 1, EBUR128_RIGHT);
+    rg_tune_read_frames (worker, tuned, read_frames, reader.decoded, rg_now () - start_time);
+    return 0;
+}
 
-                    ebur128_set_channel (args->status_peak[args->thread_id], 0, EBUR128_LEFT);
-                    ebur128_set_channel (args->status_peak[args->thread_id], 1, EBUR128_RIGHT);
-                    break;
-                case 3: // 3.1
-                    ebur128_set_channel(args->status_gain[args->thread_id], 0, EBUR128_LEFT);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 1, EBUR128_RIGHT);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 2, EBUR128_CENTER);
-
-                    ebur128_set_channel(args->status_peak[args->thread_id], 0, EBUR128_LEFT);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 1, EBUR128_RIGHT);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 2, EBUR128_CENTER);
-                    break;
-                case 4:
-                    ebur128_set_channel(args->status_gain[args->thread_id], 0, EBUR128_LEFT);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 1, EBUR128_RIGHT);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 2, EBUR128_LEFT_SURROUND);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 3, EBUR128_RIGHT_SURROUND);
-
-                    ebur128_set_channel(args->status_peak[args->thread_id], 0, EBUR128_LEFT);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 1, EBUR128_RIGHT);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 2, EBUR128_LEFT_SURROUND);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 3, EBUR128_RIGHT_SURROUND);
-                    break;
-                case 5:
-                    ebur128_set_channel(args->status_gain[args->thread_id], 0, EBUR128_LEFT);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 1, EBUR128_RIGHT);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 2, EBUR128_CENTER);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 3, EBUR128_LEFT_SURROUND);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 4, EBUR128_RIGHT_SURROUND);
-
-                    ebur128_set_channel(args->status_peak[args->thread_id], 0, EBUR128_LEFT);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 1, EBUR128_RIGHT);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 2, EBUR128_CENTER);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 3, EBUR128_LEFT_SURROUND);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 4, EBUR128_RIGHT_SURROUND);
-                    break;
-                case 6:
-                    ebur128_set_channel(args->status_gain[args->thread_id], 0, EBUR128_LEFT);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 1, EBUR128_RIGHT);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 2, EBUR128_CENTER);
-                    // LFE is not being taken into account when scanning
-                    // see R128 spec at https://tech.ebu.ch/docs/tech/tech3341.pdf
-                    ebur128_set_channel(args->status_gain[args->thread_id], 3, EBUR128_UNUSED);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 4, EBUR128_LEFT_SURROUND);
-                    ebur128_set_channel(args->status_gain[args->thread_id], 5, EBUR128_RIGHT_SURROUND);
-
-                    ebur128_set_channel(args->status_peak[args->thread_id], 0, EBUR128_LEFT);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 1, EBUR128_RIGHT);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 2, EBUR128_CENTER);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 3, EBUR128_UNUSED);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 4, EBUR128_LEFT_SURROUND);
-                    ebur128_set_channel(args->status_peak[args->thread_id], 5, EBUR128_RIGHT_SURROUND);
-                    break;
-                default:
-                    deadbeef->pl_lock ();
-                    fprintf (stderr, "rg scan: file %s has %d channels - libebur128 only supports up to 6. Aborting.\n",
-                                     deadbeef->pl_find_meta (args->scan_items[args->thread_id], ":URI"),
-                                     fileinfo->fmt.channels);
-                    deadbeef->pl_unlock ();
-                    args->result = -1;
-                    return;
-            }
-
-            int samplesize = fileinfo->fmt.channels * fileinfo->fmt.bps / 8;
-
-            int bs = 2000 * samplesize;
-
-            buffer = malloc (bs/samplesize*sizeof(float)*8*48);
-            // FIXME: don't they have to be the same size?
-            bufferf = (char*) malloc(args->status_gain[args->thread_id]->samplerate * args->status_gain[args->thread_id]->channels * sizeof(float));
-            memcpy (&fmt, &fileinfo->fmt, sizeof (fmt));
-            fmt.bps = 32;
-            fmt.is_float = 1;
-
-            int eof = 0;
-            for (;;) {
-                if (eof) {
-                    break;
-                }
-                if (args->abort && *args->abort) {
-                    fprintf (stdout, "rg scan: user asked to abort, scanning aborted.\n");
-                    break;
-                }
+static int rg_calc_item (struct rg_worker *worker, int index)
+{
+    struct rg_scan_job *job = worker->job;
+    DB_playItem_t *item = job->scan_items[job->items[index].track];
 
-                int sz = dec->read (fileinfo, buffer, bs); // read one sample
+    if (deadbeef->pl_get_item_duration (item) <= 0) {
+        deadbeef->pl_lock ();
+        fprintf (stderr, "rg scan: stream %s doesn't have finite length, skipped\n", deadbeef->pl_find_meta (item, ":URI"));
+        deadbeef->pl_unlock ();
+        return -1;
+    }
 
-                if (sz != bs) {
-                    eof = 1;
-                }
+    // the decoder is freed however scanning the item ends
+    struct rg_session session;
+    int res = rg_session_open (job, &session, item);
+    if (res == 0) {
+        worker->direct_items += session.fd >= 0;
+        res = rg_calc_session (worker, index, &session);
+    }
+    rg_session_close (job, &session);
+    return res;
+}
 
-                // convert from native output to float
-                deadbeef->pcm_convert (&fileinfo->fmt, buffer, &fmt, bufferf, sz);
-                int frames = sz / samplesize;
+/*
+ * The files of the next few tracks in the queue are read into the page cache
+ * by a separate thread while the workers decode, so a worker moving on to the
+ * next track finds it in memory instead of waiting for a disk or a network
+ * share. At most budget bytes are read ahead of the workers.
+ *
+ * Only the start of each file is read ahead. Once a decoder reads a file
+ * sequentially the kernel keeps ahead of it on its own, and reading whole
+ * files early only competes with the reads of the tracks being scanned.
+ */
+#define RG_PREFETCH_HEAD (4 << 20)
 
-                ebur128_add_frames_float(args->status_gain[args->thread_id], (float*) bufferf, frames); // collect data
-                ebur128_add_frames_float(args->status_peak[args->thread_id], (float*) bufferf, frames); // collect data
-            }
+enum {
+    RG_PREFETCH_NONE,               /* not looked at yet */
+    RG_PREFETCH_SKIPPED,            /* not a whole local file, or nothing left in the budget */
+    RG_PREFETCH_ISSUED,             /* being read ahead */
+    RG_PREFETCH_READY,              /* read ahead, waiting for a worker */
+    RG_PREFETCH_STARTED,            /* a worker has started on the track */
+};
+
+struct rg_prefetch
+{
+    int files;                      /* how many upcoming tracks are read ahead */
+    int64_t budget;                 /* bytes read ahead but not started on yet, at most */
+    int64_t pending;                /* bytes currently read ahead but not started on */
+    char *state;                    /* one of RG_PREFETCH_* for each track */
+    int64_t *bytes;                 /* bytes read ahead for each track */
+    uintptr_t cond;                 /* signalled when the workers move on */
+    int stop;
+    unsigned long issued;           /* files read ahead */
+    unsigned long hits;             /* of those, files still fully cached when a worker started */
+    int64_t issued_bytes;
+    int64_t hit_bytes;              /* bytes found in the cache when a worker started */
+    int64_t late_bytes;             /* bytes not read yet (or evicted again) when a worker started */
+    int64_t wasted_bytes;           /* bytes read ahead for tracks never started */
+};
+
+#define RG_PREFETCH_CHUNK (2 << 20)
+
+/* asks the kernel to read up to len bytes of a track's file into the page cache */
+static int64_t rg_prefetch_file (DB_playItem_t *item, int64_t len)
+{
+    char path[PATH_MAX];
+    if (rg_local_path (item, path, sizeof (path)) != 0) {
+        return 0;
+    }
+
+    int fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode) || st.st_size == 0) {
+        close (fd);
+        return 0;
+    }
+    if (len > st.st_size) {
+        len = st.st_size;
+    }
+    // the kernel reads at most the device's read-ahead size per call
+    int64_t done = 0;
+    while (done < len && posix_fadvise (fd, done, RG_PREFETCH_CHUNK, POSIX_FADV_WILLNEED) == 0) {
+        done += RG_PREFETCH_CHUNK;
+    }
+    close (fd);
+    return done < len ? done : len;
+}
+
+/* bytes of the first len bytes of a file which are in the page cache */
+static int64_t rg_cached_bytes (DB_playItem_t *item, int64_t len)
+{
+    char path[PATH_MAX];
+    if (rg_local_path (item, path, sizeof (path)) != 0) {
+        return 0;
+    }
+
+    int64_t cached = 0;
+    int fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    long page = sysconf (_SC_PAGESIZE);
+    size_t pages = (size_t) ((len + page - 1) / page);
+    void *map = mmap (NULL, (size_t) len, PROT_READ, MAP_SHARED, fd, 0);
+    unsigned char *vec = malloc (pages);
+    if (map != MAP_FAILED && vec && mincore (map, (size_t) len, vec) == 0) {
+        for (size_t i = 0; i < pages; ++i) {
+            cached += vec[i] & 1;
         }
+        cached *= page;
+        if (cached > len) {
+            cached = len;
+        }
+    }
+    free (vec);
+    if (map != MAP_FAILED) {
+        munmap (map, (size_t) len);
     }
+    close (fd);
+    return cached;
+}
 
-    // calculating track peak
-    // libEBUR128 calculates peak per channel, so we have to pick the highest value
-    double tr_peak = 0;
-    double ch_peak = 0;
-    int res;
-    for (int ch = 0; ch < fmt.channels; ++ch)
-    {
-        res = ebur128_sample_peak(args->status_peak[args->thread_id], ch, &ch_peak);
-        if (res == EBUR128_ERROR_INVALID_MODE){
-            fprintf (stderr, "rg scan: internal error: invalid mode set\n");
-            *args->abort = 1;
-            args->result = -1;
-            return;
+static void rg_prefetch_thread (void *ctx)
+{
+    struct rg_scan_job *job = ctx;
+    struct rg_prefetch *p = job->prefetch;
+
+    deadbeef->mutex_lock (job->mutex);
+    while (!p->stop && !(job->abort && *job->abort)) {
+        // the first of the next few tracks in the queue which hasn't been looked at
+        int track = -1;
+        int ahead = 0;
+        for (int i = job->next_item; i < job->num_items && ahead < p->files; ++i) {
+            struct rg_work_item *work = &job->items[i];
+            if (work->segment > 0) {
+                continue; // part of a track which has been started already
+            }
+            ahead++;
+            if (p->state[work->track] == RG_PREFETCH_NONE) {
+                track = work->track;
+                break;
+            }
         }
-        trace ("rg scan: peak for ch %d: %f\n", ch, ch_peak);
-        if (ch_peak > tr_peak){
-            trace ("rg scan: %f > %f\n", ch_peak, tr_peak);
-            tr_peak = ch_peak;
+        if (track < 0 || p->pending >= p->budget) {
+            deadbeef->cond_wait (p->cond, job->mutex);
+            continue;
+        }
+
+        // only the windows of sampled tracks are read, and subtracks are a part of their file
+        struct rg_work_item *work = &job->items[job->first_item[track]];
+        if (work->sampled || deadbeef->pl_get_item_flags (job->scan_items[track]) & DDB_IS_SUBTRACK) {
+            p->state[track] = RG_PREFETCH_SKIPPED;
+            continue;
+        }
+        p->state[track] = RG_PREFETCH_ISSUED;
+        int64_t len = p->budget - p->pending < RG_PREFETCH_HEAD ? p->budget - p->pending : RG_PREFETCH_HEAD;
+        deadbeef->mutex_unlock (job->mutex);
+
+        len = rg_prefetch_file (job->scan_items[track], len);
+
+        deadbeef->mutex_lock (job->mutex);
+        if (len <= 0) {
+            p->state[track] = RG_PREFETCH_SKIPPED;
+        }
+        else {
+            p->issued++;
+            p->issued_bytes += len;
+            p->bytes[track] = len;
+            if (p->state[track] == RG_PREFETCH_ISSUED) {
+                p->state[track] = RG_PREFETCH_READY;
+                p->pending += len;
+            }
+            // a worker has started on it meanwhile, too late to tell if it helped
         }
     }
-    args->out_track_pk[args->thread_id] = (float) tr_peak;
+    deadbeef->mutex_unlock (job->mutex);
+}
 
-    // calculate track loudness
-    ebur128_loudness_global(args->status_gain[args->thread_id], &args->loudness);
-    /*
-     * EBUR128 sets the target level to -23 LUFS = 84dB
-     * -> -23 - loudness = track gain to get to 84dB
-     *
-     * The old implementation of RG used 89dB, most people still use that
-     * -> the above + (targetdb - 84) = track gain to get to 89dB (or user specified)
-     */
-    args->out_track_rg[args->thread_id] = (float) (-23 - args->loudness + *args->targetdb - 84);
+/* called by a worker about to scan an item, counts how much of the read-ahead was still cached */
+static void rg_prefetch_start (struct rg_scan_job *job, int track)
+{
+    struct rg_prefetch *p = job->prefetch;
+    deadbeef->mutex_lock (job->mutex);
+    int state = p->state[track];
+    p->state[track] = RG_PREFETCH_STARTED;
+    if (state == RG_PREFETCH_READY) {
+        p->pending -= p->bytes[track];
+    }
+    deadbeef->cond_signal (p->cond);
+    deadbeef->mutex_unlock (job->mutex);
+    if (state != RG_PREFETCH_READY) {
+        return;
+    }
+
+    int64_t cached = rg_cached_bytes (job->scan_items[track], p->bytes[track]);
+    deadbeef->mutex_lock (job->mutex);
+    if (cached == p->bytes[track]) {
+        p->hits++;
+    }
+    p->hit_bytes += cached;
+    p->late_bytes += p->bytes[track] - cached;
+    deadbeef->mutex_unlock (job->mutex);
+}
 
-    // clean up
-    if (buffer) {
-        free (buffer);
-        buffer = NULL;
+/*
+ * Hands out the next item in the queue. With a limit of readers per disk it
+ * is the first one on a disk with a reader to spare, waiting until there is
+ * one, so more workers than a spinning disk can serve don't make it seek
+ * between files. Called with job->mutex held, -1 when all are handed out.
+ */
+static int rg_take_item (struct rg_scan_job *job)
+{
+    if (!job->taken) {
+        return job->next_item < job->num_items ? job->next_item++ : -1;
     }
-    if (bufferf) {
-        free (bufferf);
-        bufferf = NULL;
+    for (int waited = 0;; waited = 1) {
+        while (job->next_item < job->num_items && job->taken[job->next_item]) {
+            job->next_item++;
+        }
+        if (job->next_item == job->num_items || (job->abort && *job->abort)) {
+            return -1;
+        }
+        // only go through the queue if a disk with items left has a reader to spare
+        int spare = 0;
+        for (int d = 0; d < job->num_devices && !spare; ++d) {
+            spare = job->devices[d].left > 0 && (d == RG_NO_DEVICE || job->devices[d].readers < job->disk_readers);
+        }
+        for (int i = job->next_item; spare && i < job->num_items; ++i) {
+            int d = job->items[i].device;
+            if (!job->taken[i] && (d == RG_NO_DEVICE || job->devices[d].readers < job->disk_readers)) {
+                job->taken[i] = 1;
+                job->devices[d].readers++;
+                job->devices[d].left--;
+                job->reader_waits += waited;
+                return i;
+            }
+        }
+        deadbeef->cond_wait (job->reader_cond, job->mutex);
     }
 }
 
-int rg_scan (DB_playItem_t **scan_items,     // tracks to scan
-             const int *num_tracks,          // how many tracks
-             float *out_track_rg,            // individual track replay gain
-             float *out_track_pk,            // individual track peak
-             float *out_album_rg,            // album track replay gain
-             float *out_album_pk,            // album peak
-             float *targetdb,                // our target loudness
-             int *num_threads,               // number of threads
-             int *abort)                     // will be set to 1 if scanning was aborted
+static void rg_worker_thread (void *ctx)
+{
+    struct rg_worker *worker = ctx;
+    struct rg_scan_job *job = worker->job;
+
+    for (;;) {
+        if (job->abort && *job->abort) {
+            fprintf (stdout, "rg scan: user asked to abort, main loop aborted.\n");
+            break;
+        }
+
+        /* take the next item off the queue */
+        deadbeef->mutex_lock (job->mutex);
+        int index = rg_take_item (job);
+        deadbeef->mutex_unlock (job->mutex);
+        if (index < 0) {
+            break;
+        }
+
+        double start = rg_now ();
+        int track = job->items[index].track;
+        if (job->prefetch) {
+            rg_prefetch_start (job, track);
+        }
+        int res = rg_calc_item (worker, index);
+
+        /* whoever scans the last segment of a track calculates its results */
+        deadbeef->mutex_lock (job->mutex);
+        if (res != 0) {
+            job->failed[track] = 1;
+        }
+        int last = --job->segments_left[track] == 0;
+        if (job->taken) {
+            job->devices[job->items[index].device].readers--;
+            deadbeef->cond_broadcast (job->reader_cond);
+        }
+        deadbeef->mutex_unlock (job->mutex);
+        if (last) {
+            rg_finish_track (worker, track);
+        }
+        worker->busy += rg_now () - start;
+        worker->items++;
+    }
+}
+
+/* scans the tracks completely, or only in quick_windows windows each if it is not 0 */
+static int rg_scan_tracks (DB_playItem_t **scan_items,
+                           const int *num_tracks,
+                           float *out_track_rg,
+                           float *out_track_pk,
+                           float *out_track_err,
+                           float *out_album_rg,
+                           float *out_album_pk,
+                           float *targetdb,
+                           int *num_threads,
+                           int quick_windows,
+                           int *abort)
 {
     if(*num_threads <= 0)
     {
@@ -294,98 +1805,319 @@ int rg_scan (DB_playItem_t **scan_items,     // tracks to scan
 
     trace("rg scan: using %d thread(s)\n", *num_threads);
 
-    ebur128_state **status_gain = NULL;
-    ebur128_state **status_peak = NULL;
     double loudness;
 
     *out_album_pk = 0;
     *out_album_rg = 0;
 
-    // allocate status array
-    status_gain = malloc((size_t) *num_tracks * sizeof(ebur128_state*));
-    status_peak = malloc((size_t) *num_tracks * sizeof(ebur128_state*));
+    struct rg_scan_job job;
+    memset (&job, 0, sizeof (job));
+    job.scan_items = scan_items;
+    job.num_tracks = *num_tracks;
+    job.out_track_rg = out_track_rg;
+    job.out_track_pk = out_track_pk;
+    job.out_track_err = out_track_err;
+    job.targetdb = targetdb;
+    job.abort = abort;
+
+    for(int i = 0; i < *num_tracks; ++i){
+        out_track_rg[i] = 0;
+        out_track_pk[i] = 0;
+        if (out_track_err) {
+            out_track_err[i] = 0;
+        }
+    }
+
+    job.first_item = malloc(*num_tracks * sizeof(int));
+    job.segments_left = malloc(*num_tracks * sizeof(int));
+    job.failed = calloc(*num_tracks, sizeof(char));
+    job.mutex = deadbeef->mutex_create ();
+
+    /* uncompressed files are read without their decoder */
+    job.direct_pcm = deadbeef->conf_get_int ("rgscan.direct_pcm", 1);
+
+    /* decoding and analysis of each item can overlap on two threads */
+    job.pipeline = deadbeef->conf_get_int ("rgscan.pipeline", 0);
+
+    /* frames per decoder read, 0 lets each worker find the fastest size per decoder */
+    job.read_frames = deadbeef->conf_get_int ("rgscan.read_frames", 0);
+    if (job.read_frames > 65536) {
+        job.read_frames = 65536;
+    }
+    else if (job.read_frames > 0 && job.read_frames < 1024) {
+        job.read_frames = 1024;
+    }
+
+    /* single precision filtering is faster and well within the 0.01 dB tag precision */
+    job.ebur128_mode = deadbeef->conf_get_int ("rgscan.single_precision", 0) ? EBUR128_MODE_SINGLE_PRECISION : 0;
+
+    /* the interpolated true peak also catches peaks between samples that clip after lossy encoding */
+    if (deadbeef->conf_get_int ("rgscan.true_peak", 0)) {
+        job.ebur128_mode |= EBUR128_MODE_TRUE_PEAK;
+    }
+
+    /* hi-res tracks are measured at 44.1 or 48 kHz, peaks still come from the full rate */
+    if (deadbeef->conf_get_int ("rgscan.decimate", 0)) {
+        job.ebur128_mode |= EBUR128_MODE_DECIMATE;
+    }
+
+    /* tracks at least twice this long are split into segments scanned in parallel */
+    job.segment_length = deadbeef->conf_get_float ("rgscan.segment_length", 300);
+    if (job.segment_length > 0 && job.segment_length < 10) {
+        job.segment_length = 10;
+    }
+
+    /* tracks long enough are only measured in this many windows */
+    job.quick_windows = quick_windows;
+
+    /* workers reading from one disk at once, more make a spinning disk seek between files */
+    job.disk_readers = deadbeef->conf_get_int ("rgscan.disk_readers", 0);
+    if (job.disk_readers < 0) {
+        job.disk_readers = 0;
+    }
+
+    /*
+     * the album is done only when its last track is, so by default the
+     * longest tracks are scanned first and the short ones fill the gaps.
+     * The settings dialog stores the index of the order, older configs
+     * its name.
+     */
+    char schedule_name[100];
+    deadbeef->conf_get_str ("rgscan.schedule", "1", schedule_name, sizeof (schedule_name));
+    int schedule = -1;
+    for (int i = 0; i < RG_SCHEDULES; i++) {
+        if (!strcmp (schedule_name, rg_schedule_names[i]) || (schedule_name[0] == '0' + i && !schedule_name[1])) {
+            schedule = i;
+        }
+    }
+    if (schedule < 0) {
+        fprintf (stderr, "rg scan: unknown scan order \"%s\" in rgscan.schedule, scanning the longest tracks first\n", schedule_name);
+        schedule = RG_SCHEDULE_LONGEST_FIRST;
+    }
+    double predicted = rg_schedule (&job, *num_threads, schedule);
+
+    /*
+     * no point in starting more workers than there are work items, which
+     * may be more than there are tracks once they are split into segments
+     */
+    int num_workers = *num_threads < job.num_items ? *num_threads : job.num_items;
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
 
-    /* used for joining threads */
+    struct rg_worker *workers = NULL;
     intptr_t *rg_threads = NULL;
-    rg_threads = malloc(*num_tracks * sizeof(intptr_t));
-    struct rg_thread_arg *args = NULL;
-    args = malloc(*num_tracks * sizeof(struct rg_thread_arg));
+    workers = calloc(num_workers, sizeof(struct rg_worker));
+    rg_threads = malloc(num_workers * sizeof(intptr_t));
 
-    // calculate gain for each track
-    for(int i = 0; i < *num_tracks; ++i){
-        /* limit number of parallel threads */
-        if(i >= *num_threads)
-        {
-            /* simple blocking mechanism: join 'oldest' thread */
-            deadbeef->thread_join(rg_threads[i - *num_threads]);
-        }
-        /* initialize arguments */
-        args[i].result = 0;
-        *(int*)(&args[i].thread_id) = i;
-        args[i].scan_items = scan_items;
-        args[i].out_track_rg = out_track_rg;
-        args[i].out_track_pk = out_track_pk;
-        args[i].targetdb = targetdb;
-        args[i].abort = abort;
-        args[i].status_gain = status_gain;
-        args[i].status_peak = status_peak;
-        args[i].loudness = loudness;
-
-        /* run thread */
-        rg_threads[i] = deadbeef->thread_start(&rg_calc_thread, (void*)(&args[i]));
-    }
-
-    /* wait for remaining threads to join */
-    int remaining_thread_id = (*num_tracks) - *num_threads;
-    if(remaining_thread_id < 0)
-    {
-        remaining_thread_id = 0;
+    /* decoders open at once, the workers beyond it wait for one to be freed */
+    job.max_open_files = deadbeef->conf_get_int ("rgscan.open_files", 0);
+    if (job.max_open_files > 0 && job.max_open_files < num_workers) {
+        job.files_cond = deadbeef->cond_create ();
+    }
+
+    // the limit only matters with more workers than disks
+    if (job.disk_readers > 0 && job.disk_readers * (job.num_devices - 1) < num_workers) {
+        job.taken = calloc ((size_t) job.num_items, sizeof (char));
+        job.reader_cond = deadbeef->cond_create ();
     }
-    for(int i = remaining_thread_id; i < *num_tracks; ++i)
+
+    // allocate status array, items which fail to scan keep a NULL state
+    job.status = calloc((size_t) job.num_items, sizeof(ebur128_state*));
+
+    /* the start of the files of this many upcoming tracks is read ahead, up to a budget of megabytes */
+    struct rg_prefetch prefetch;
+    memset (&prefetch, 0, sizeof (prefetch));
+    prefetch.files = deadbeef->conf_get_int ("rgscan.prefetch_files", 0);
+    prefetch.budget = (int64_t) deadbeef->conf_get_int ("rgscan.prefetch_mb", 256) << 20;
+    intptr_t prefetch_tid = 0;
+    if (prefetch.files > 0 && prefetch.budget > 0) {
+        prefetch.state = calloc (*num_tracks, sizeof (char));
+        prefetch.bytes = calloc (*num_tracks, sizeof (int64_t));
+        prefetch.cond = deadbeef->cond_create ();
+        if (prefetch.state && prefetch.bytes && prefetch.cond) {
+            job.prefetch = &prefetch;
+            prefetch_tid = deadbeef->thread_start (&rg_prefetch_thread, &job);
+        }
+    }
+
+    double start = rg_now ();
+
+    // start the workers, each of them scans tracks until the queue is empty
+    for(int i = 0; i < num_workers; ++i){
+        workers[i].job = &job;
+        workers[i].worker_id = i;
+        rg_threads[i] = deadbeef->thread_start(&rg_worker_thread, (void*)(&workers[i]));
+    }
+    for(int i = 0; i < num_workers; ++i)
     {
         deadbeef->thread_join(rg_threads[i]);
     }
 
-    // update album peak if necessary
+    double elapsed = rg_now () - start;
+
+    if (job.prefetch) {
+        deadbeef->mutex_lock (job.mutex);
+        prefetch.stop = 1;
+        deadbeef->cond_signal (prefetch.cond);
+        deadbeef->mutex_unlock (job.mutex);
+        deadbeef->thread_join (prefetch_tid);
+        // files read ahead of tracks which were never started, e.g. after aborting
+        for (int i = 0; i < *num_tracks; ++i) {
+            if (prefetch.state[i] == RG_PREFETCH_READY) {
+                prefetch.wasted_bytes += prefetch.bytes[i];
+            }
+        }
+        fprintf (stdout, "rg scan: read ahead %lu file(s), %.1f MB: %lu hit(s) fully cached when started, "
+                 "%.1f MB cached, %.1f MB not read yet, %.1f MB wasted\n",
+                 prefetch.issued, prefetch.issued_bytes / 1048576.0, prefetch.hits,
+                 prefetch.hit_bytes / 1048576.0, prefetch.late_bytes / 1048576.0, prefetch.wasted_bytes / 1048576.0);
+    }
+    if (prefetch.cond) {
+        deadbeef->cond_free (prefetch.cond);
+    }
+    free (prefetch.state);
+    free (prefetch.bytes);
+
+    /* report how well the workers were utilized */
+    double busy = 0;
+    int direct_items = 0;
+    for(int i = 0; i < num_workers; ++i)
+    {
+        fprintf (stdout, "rg scan: worker %d scanned %d item(s), busy %.2fs of %.2fs (%.0f%%)\n",
+                 i, workers[i].items, workers[i].busy, elapsed,
+                 elapsed > 0 ? 100 * workers[i].busy / elapsed : 100.0);
+        if (workers[i].ring) {
+            fprintf (stdout, "rg scan: worker %d pipeline stalls: decoder %lu, analysis %lu\n",
+                     i, workers[i].ring->decode_stalls, workers[i].ring->analysis_stalls);
+        }
+        busy += workers[i].busy;
+        direct_items += workers[i].direct_items;
+    }
+
+    /* convert the predicted makespan to wall time using the measured scanning speed */
+    double audio = 0;
+    for(int i = 0; i < job.num_items; ++i)
+    {
+        audio += job.items[i].duration;
+    }
+    fprintf (stdout, "rg scan: %s schedule, predicted makespan %.2fs (%.2fs of audio), actual %.2fs\n",
+             rg_schedule_names[schedule],
+             audio > 0 ? predicted * busy / audio : 0.0, predicted, elapsed);
+    if (direct_items > 0) {
+        fprintf (stdout, "rg scan: %d item(s) read without a decoder\n", direct_items);
+    }
+    if (job.files_cond) {
+        fprintf (stdout, "rg scan: at most %d of %d decoder(s) open at once, %lu item(s) waited for one\n",
+                 job.peak_open_files, job.max_open_files, job.file_waits);
+    }
+    if (job.taken) {
+        fprintf (stdout, "rg scan: at most %d reader(s) per disk, %lu item(s) waited for a disk\n",
+                 job.disk_readers, job.reader_waits);
+    }
+
+    // update album peak if necessary, it is unknown if the peak of a sampled track is
     for(int i = 0; i < *num_tracks; ++i)
     {
-        if (*out_album_pk < args[i].out_track_pk[i]){
-            *out_album_pk = args[i].out_track_pk[i];
+        if (out_track_pk[i] < 0) {
+            *out_album_pk = -1;
+            break;
+        }
+        if (*out_album_pk < out_track_pk[i]){
+            *out_album_pk = out_track_pk[i];
         }
     }
 
-    /* free thread storage */
+    /* free worker storage */
+    deadbeef->mutex_free (job.mutex);
+    if (job.reader_cond) {
+        deadbeef->cond_free (job.reader_cond);
+    }
+    if (job.files_cond) {
+        deadbeef->cond_free (job.files_cond);
+    }
+    free(job.taken);
+    free(job.devices);
+    free(job.items);
+    free(job.first_item);
+    free(job.segments_left);
+    free(job.failed);
+    if(workers)
+    {
+        for(int i = 0; i < num_workers; ++i)
+        {
+            free(workers[i].buffer);
+            free(workers[i].converted);
+            for (int j = 0; j < workers[i].pool_size; ++j) {
+                ebur128_destroy(&workers[i].pool[j]);
+            }
+            if (workers[i].ring) {
+                for (int j = 0; j < RG_RING_SLOTS; ++j) {
+                    free(workers[i].ring->slots[j].data);
+                    free(workers[i].ring->slots[j].converted);
+                }
+                deadbeef->cond_free (workers[i].ring->cond);
+                deadbeef->mutex_free (workers[i].ring->mutex);
+                free(workers[i].ring);
+            }
+        }
+        free(workers);
+        workers = NULL;
+    }
     if(rg_threads)
     {
         free(rg_threads);
         rg_threads = NULL;
     }
-    if(args)
-    {
-        free(args);
-        args = NULL;
-    }
 
     // calculate album loudness
-    ebur128_loudness_global_multiple(status_gain, (size_t) *num_tracks, &loudness);
+    ebur128_loudness_summary(&job.album, &loudness);
     *out_album_rg = -23 - (float) loudness + *targetdb - 84; // see above
 
-    // clean up
-    if (status_gain){
-        for (int i = 0; i < *num_tracks; ++i) {
-            ebur128_destroy(&status_gain[i]);
-        }
-        free(status_gain);
-    }
-    if (status_peak){
-        for (int i = 0; i < *num_tracks; ++i) {
-            ebur128_destroy(&status_peak[i]);
+    // clean up, states are left only if scanning was aborted
+    if (job.status){
+        for (int i = 0; i < job.num_items; ++i) {
+            if (job.status[i]) {
+                ebur128_destroy(&job.status[i]);
+            }
         }
-        free(status_peak);
+        free(job.status);
     }
     return 0;
 }
 
+int rg_scan (DB_playItem_t **scan_items,     // tracks to scan
+             const int *num_tracks,          // how many tracks
+             float *out_track_rg,            // individual track replay gain
+             float *out_track_pk,            // individual track peak
+             float *out_album_rg,            // album track replay gain
+             float *out_album_pk,            // album peak
+             float *targetdb,                // our target loudness
+             int *num_threads,               // number of threads
+             int *abort)                     // will be set to 1 if scanning was aborted
+{
+    return rg_scan_tracks (scan_items, num_tracks, out_track_rg, out_track_pk, NULL,
+                           out_album_rg, out_album_pk, targetdb, num_threads, 0, abort);
+}
+
+int rg_scan_quick (DB_playItem_t **scan_items,     // tracks to scan
+                   const int *num_tracks,          // how many tracks
+                   float *out_track_rg,            // individual track replay gain
+                   float *out_track_pk,            // individual track peak
+                   float *out_track_err,           // bound of each track gain
+                   float *out_album_rg,            // album track replay gain
+                   float *out_album_pk,            // album peak
+                   float *targetdb,                // our target loudness
+                   int *num_threads,               // number of threads
+                   const int *num_windows,         // windows measured per track
+                   int *abort)                     // will be set to 1 if scanning was aborted
+{
+    // fewer than two windows give no idea of how far off the estimate is
+    int windows = *num_windows < 2 ? 2 : *num_windows;
+    return rg_scan_tracks (scan_items, num_tracks, out_track_rg, out_track_pk, out_track_err,
+                           out_album_rg, out_album_pk, targetdb, num_threads, windows, abort);
+}
+
 int rg_write_meta (DB_playItem_t *track){
     deadbeef->pl_lock ();
     const char *dec = deadbeef->pl_find_meta_raw (track, ":DECODER");
@@ -481,7 +2213,7 @@ static rg_scan_t plugin = {
     .misc.plugin.api_vmajor = 1,
     .misc.plugin.api_vminor = 8,
     .misc.plugin.version_major = 1,
-    .misc.plugin.version_minor = 0,
+    .misc.plugin.version_minor = 1,
     .misc.plugin.type = DB_PLUGIN_MISC,
     .misc.plugin.name = "Replay Gain Scanner",
     .misc.plugin.id = "rgscanner",
@@ -511,5 +2243,6 @@ static rg_scan_t plugin = {
     .misc.plugin.website = "https://github.com/Soukyuu/ddb_misc_replaygain_scan",
     .rg_scan = rg_scan,
     .rg_apply = rg_apply,
-    .rg_remove = rg_remove
+    .rg_remove = rg_remove,
+    .rg_scan_quick = rg_scan_quick
 };
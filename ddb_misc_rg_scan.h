@@ -50,6 +50,29 @@ typedef struct{
 
     void (*rg_remove) (DB_playItem_t **work_items,
                        const int *num_tracks);
+
+    // since 1.1: like rg_scan, but tracks long enough are only measured in
+    // num_windows windows, one at a pseudo-random position in each of
+    // num_windows equal parts of the track, so gains are estimates. The
+    // peaks of those tracks are not measured: out_track_pk is -1 for them,
+    // and out_album_pk is -1 if there are any. The results are meant to be
+    // looked at, not written to tags. out_track_err gets an approximate 95%
+    // bound of each track gain in dB. It treats the windows as random samples
+    // of the track, so it only holds because of their random placement. It is
+    // 0 for tracks that were scanned completely because they are too short to
+    // sample or their decoder can't seek, and -1 for tracks which failed to
+    // scan.
+    int (*rg_scan_quick) (DB_playItem_t **scan_items,     // tracks to scan
+                          const int *num_tracks,          // how many tracks
+                          float *out_track_rg,            // individual track replay gain
+                          float *out_track_pk,            // individual track peak
+                          float *out_track_err,           // bound of each track gain
+                          float *out_album_rg,            // album track replay gain
+                          float *out_album_pk,            // album peak
+                          float *targetdb,                // our target loudness
+                          int *num_threads,               // number of threads
+                          const int *num_windows,         // windows measured per track
+                          int *abort);                    // will be set to 1 if scanning was aborted
 } rg_scan_t;
 
 #endif //__DDB_RG
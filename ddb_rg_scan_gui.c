@@ -41,6 +41,7 @@
 DB_functions_t *deadbeef;
 
 rg_scan_t *scanner_plugin;
+int quick_scan_supported;                   // scanner has rg_scan_quick, since 1.1
 ddb_gtkui_t *gtkui_plugin;
 
 enum // used to populate results dialog
@@ -50,12 +51,26 @@ enum // used to populate results dialog
   COL_TPK,
   COL_ARG,
   COL_APK,
+  COL_EST,
   NUM_COLS
 } ;
 
 static const char settings_dlg[] =
     "property \"Target db volume level\" entry rgscan.target 89.0;\n" \
-    "property \"Number of threads (0 = auto)\" entry rgscan.num_threads 0;\n"
+    "property \"Number of threads (0 = auto)\" entry rgscan.num_threads 0;\n" \
+    "property \"Scan order\" select[3] rgscan.schedule 1 selection longest_first disk;\n" \
+    "property \"Workers reading from one disk at most (0 = no limit)\" entry rgscan.disk_readers 0;\n" \
+    "property \"Decoders open at once at most (0 = one per worker)\" entry rgscan.open_files 0;\n" \
+    "property \"Scan tracks at least twice this long in segments of (seconds, 0 = off)\" entry rgscan.segment_length 300;\n" \
+    "property \"Decode and analyse on separate threads\" checkbox rgscan.pipeline 0;\n" \
+    "property \"Read uncompressed WAV and AIFF files without their decoder\" checkbox rgscan.direct_pcm 1;\n" \
+    "property \"Frames per decoder read (0 = tune automatically)\" entry rgscan.read_frames 0;\n" \
+    "property \"Read ahead files of the next tracks (0 = off)\" entry rgscan.prefetch_files 0;\n" \
+    "property \"Read ahead at most (MB)\" entry rgscan.prefetch_mb 256;\n" \
+    "property \"Filter in single precision (faster)\" checkbox rgscan.single_precision 0;\n" \
+    "property \"Write true peak instead of sample peak (slower)\" checkbox rgscan.true_peak 0;\n" \
+    "property \"Measure hi-res tracks at 44.1/48 kHz (faster preview)\" checkbox rgscan.decimate 0;\n" \
+    "property \"Quick scan: windows measured per track\" entry rgscan.quick_windows 8;\n"
 ;
 
 typedef struct {
@@ -66,6 +81,7 @@ typedef struct {
     float *album_gain;
     float *track_peak;
     float *album_peak;
+    float *track_err;               // bound of estimated track gains, quick scans only
 
     GtkWidget *progress;
     GtkWidget *progress_entry;
@@ -76,6 +92,7 @@ typedef struct {
     float targetdb;
     int num_items;
     int num_threads;
+    int quick_windows;              // windows measured per track, 0 = full scan
     int cancelled;
 
 } scanner_ctx_t;
@@ -118,6 +135,9 @@ rg_cleanup () {
     if (current_ctx->album_peak) {
         free (current_ctx->album_peak);
     }
+    if (current_ctx->track_err) {
+        free (current_ctx->track_err);
+    }
     free (current_ctx);
     current_ctx = NULL;
     trace ("rg scan: cleaning complete, exiting\n");
@@ -165,7 +185,8 @@ on_btn_apply_rg_released (GtkButton *button, gpointer user_data)
     scanner_ctx_t *scan = current_ctx;
     for (int i = 0; i < scan->num_items; ++i) {
         // TODO: show progress
-        if (scanner_plugin->rg_apply (scan->scan_items[i], &scan->track_gain[i], &scan->track_peak[i], scan->album_gain, scan->album_peak)) {
+        // estimates of a quick scan are never written, see results_cb
+        if (!scan->track_err && scanner_plugin->rg_apply (scan->scan_items[i], &scan->track_gain[i], &scan->track_peak[i], scan->album_gain, scan->album_peak)) {
             deadbeef->pl_lock();
             fprintf (stderr, "rg scan: failed to apply RG tags to %s\n", deadbeef->pl_find_meta (scan->scan_items[i], ":URI"));
             deadbeef->pl_unlock();
@@ -207,10 +228,23 @@ results_cb (void *ctx) {
                                 G_TYPE_FLOAT,   // track gain
                                 G_TYPE_FLOAT,   // track peak
                                 G_TYPE_FLOAT,   // album gain
-                                G_TYPE_FLOAT);  // album peak
+                                G_TYPE_FLOAT,   // album peak
+                                G_TYPE_STRING); // whether track gain is estimated
 
     // fill rows with data
     for (int i = 0; i < scan->num_items; ++i){
+        char estimate[50] = "";
+        if (scan->track_err) {
+            if (scan->track_err[i] < 0) {
+                snprintf (estimate, sizeof (estimate), "failed to scan");
+            }
+            else if (scan->track_err[i] > 0) {
+                snprintf (estimate, sizeof (estimate), "estimated, \xc2\xb1%.2f dB", scan->track_err[i]);
+            }
+            else {
+                snprintf (estimate, sizeof (estimate), "scanned completely");
+            }
+        }
         deadbeef->pl_lock ();
         gtk_list_store_append (store, &it);
         trace ("rg scan: %s | %f | %f | %f | %f\n", deadbeef->pl_find_meta (scan->scan_items[i], ":URI"), 
@@ -224,6 +258,7 @@ results_cb (void *ctx) {
                             COL_TPK, (gfloat) scan->track_peak[i],
                             COL_ARG, (gfloat) *scan->album_gain,
                             COL_APK, (gfloat) *scan->album_peak,
+                            COL_EST, estimate,
                             -1);
         deadbeef->pl_unlock();
     }
@@ -248,13 +283,16 @@ results_cb (void *ctx) {
                                                  "text", COL_TRG,
                                                  NULL);
 
-    renderer = gtk_cell_renderer_text_new ();
-    gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (treeview),
-                                                 2,
-                                                 "Track Peak",
-                                                 renderer,
-                                                 "text", COL_TPK,
-                                                 NULL);
+    // a quick scan doesn't measure the peaks of the tracks it samples
+    if (!scan->track_err) {
+        renderer = gtk_cell_renderer_text_new ();
+        gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (treeview),
+                                                     2,
+                                                     "Track Peak",
+                                                     renderer,
+                                                     "text", COL_TPK,
+                                                     NULL);
+    }
 
     renderer = gtk_cell_renderer_text_new ();
     gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (treeview),
@@ -264,13 +302,28 @@ results_cb (void *ctx) {
                                                  "text", COL_ARG,
                                                  NULL);
 
-    renderer = gtk_cell_renderer_text_new ();
-    gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (treeview),
-                                                 4,
-                                                 "Album Peak",
-                                                 renderer,
-                                                 "text", COL_APK,
-                                                 NULL);
+    if (!scan->track_err) {
+        renderer = gtk_cell_renderer_text_new ();
+        gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (treeview),
+                                                     4,
+                                                     "Album Peak",
+                                                     renderer,
+                                                     "text", COL_APK,
+                                                     NULL);
+    }
+
+    if (scan->track_err) {
+        renderer = gtk_cell_renderer_text_new ();
+        gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (treeview),
+                                                     5,
+                                                     "Quick Scan",
+                                                     renderer,
+                                                     "text", COL_EST,
+                                                     NULL);
+        gtk_window_set_title (GTK_WINDOW (scan->results), _("Replay Gain Quick Scan Results (estimated)"));
+        // estimates are not written to tags, a full scan has to follow
+        gtk_widget_set_sensitive (lookup_widget (scan->results, "btn_apply_rg"), FALSE);
+    }
 
     // set model
     gtk_tree_view_set_model (GTK_TREE_VIEW (treeview), GTK_TREE_MODEL (store));
@@ -297,6 +350,9 @@ scanner_worker (void *ctx) {
     scan->track_peak = (float *) malloc (scan->num_items * sizeof (float));
     scan->album_gain = (float *) malloc (sizeof (float));
     scan->album_peak = (float *) malloc (sizeof (float));
+    if (scan->quick_windows > 0) {
+        scan->track_err = (float *) malloc (scan->num_items * sizeof (float));
+    }
 
     update_progress_info_t *info = malloc (sizeof (update_progress_info_t));
     info->entry = scan->progress_entry;
@@ -306,7 +362,12 @@ scanner_worker (void *ctx) {
 
     int result = -1;
 
-    result = scanner_plugin->rg_scan (scan->scan_items, &scan->num_items, scan->track_gain, scan->track_peak, scan->album_gain, scan->album_peak, &scan->targetdb, &scan->num_threads, &scan->cancelled);
+    if (scan->quick_windows > 0) {
+        result = scanner_plugin->rg_scan_quick (scan->scan_items, &scan->num_items, scan->track_gain, scan->track_peak, scan->track_err, scan->album_gain, scan->album_peak, &scan->targetdb, &scan->num_threads, &scan->quick_windows, &scan->cancelled);
+    }
+    else {
+        result = scanner_plugin->rg_scan (scan->scan_items, &scan->num_items, scan->track_gain, scan->track_peak, scan->album_gain, scan->album_peak, &scan->targetdb, &scan->num_threads, &scan->cancelled);
+    }
 
     if (result == 0)
     {
@@ -336,12 +397,13 @@ scanner_worker (void *ctx) {
     deadbeef->background_job_decrement ();
 }
 
+// quick scans measure each track in quick_windows windows, 0 scans everything
 static gboolean
-rg_scan_run_cb (void *data) {
-    int ctx = (intptr_t)data;
+rg_scan_start (int ctx, int quick_windows) {
     scanner_ctx_t *scan = malloc (sizeof (scanner_ctx_t));
     current_ctx = scan;
     memset (scan, 0, sizeof (scanner_ctx_t));
+    scan->quick_windows = quick_windows;
 
     deadbeef->pl_lock ();
     switch (ctx) {
@@ -448,6 +510,17 @@ rg_scan_run_cb (void *data) {
     return FALSE;
 }
 
+static gboolean
+rg_scan_run_cb (void *data) {
+    return rg_scan_start ((intptr_t)data, 0);
+}
+
+static gboolean
+rg_quick_scan_run_cb (void *data) {
+    int windows = deadbeef->conf_get_int ("rgscan.quick_windows", 8);
+    return rg_scan_start ((intptr_t)data, windows < 2 ? 2 : windows);
+}
+
 static int
 rg_scan_run (DB_plugin_action_t *act, int ctx) {
     // this can be called from non-gtk thread
@@ -455,6 +528,12 @@ rg_scan_run (DB_plugin_action_t *act, int ctx) {
     return 0;
 }
 
+static int
+rg_quick_scan_run (DB_plugin_action_t *act, int ctx) {
+    gdk_threads_add_idle (rg_quick_scan_run_cb, (void *)(intptr_t)ctx);
+    return 0;
+}
+
 static gboolean
 rg_remove_run_cb (void *data) {
     int ctx = (intptr_t)data;
@@ -530,12 +609,20 @@ static DB_plugin_action_t remove_action = {
     .next = NULL
 };
 
+static DB_plugin_action_t quick_scan_action = {
+    .title = "Replay Gain/Quick scan as single album (estimated)",
+    .name = "rg_quick_scan",
+    .flags = DB_ACTION_MULTIPLE_TRACKS | DB_ACTION_SINGLE_TRACK | DB_ACTION_ADD_MENU,
+    .callback2 = rg_quick_scan_run,
+    .next = &remove_action
+};
+
 static DB_plugin_action_t scan_action = {
     .title = "Replay Gain/Scan as single album",
     .name = "rg_scan",
     .flags = DB_ACTION_MULTIPLE_TRACKS | DB_ACTION_SINGLE_TRACK | DB_ACTION_ADD_MENU,
     .callback2 = rg_scan_run,
-    .next = &remove_action
+    .next = &quick_scan_action
 };
 
 static DB_plugin_action_t *
@@ -543,6 +630,9 @@ rg_scan_gui_get_actions (DB_playItem_t *plt)
 {
     deadbeef->pl_lock ();
     remove_action.flags |= DB_ACTION_DISABLED;  // default state is disabled
+    if (!quick_scan_supported) {
+        quick_scan_action.flags |= DB_ACTION_DISABLED;
+    }
     DB_playItem_t *it = deadbeef->pl_get_first (PL_MAIN);
     while (it) {
         if (deadbeef->pl_is_selected (it) && has_rg_tags (it)) {
@@ -574,6 +664,7 @@ rg_scan_gui_connect (void) {
         fprintf (stderr, "rgscangui: need rg scanner>=1.0, but found %d.%d\n", scanner_plugin->misc.plugin.version_major, scanner_plugin->misc.plugin.version_minor);
         return -1;
     }
+    quick_scan_supported = PLUG_TEST_COMPAT(&scanner_plugin->misc.plugin, 1, 1);
     return 0;
 }
 
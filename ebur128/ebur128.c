@@ -5,14 +5,21 @@
 #include <float.h>
 #include <limits.h>
 #include <math.h> /* You may have to define _USE_MATH_DEFINES if you use MSVC */
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* This can be replaced by any BSD-like queue implementation. */
 #include <sys/queue.h>
 
-#ifdef USE_SPEEX_RESAMPLER
-  #include <speex/speex_resampler.h>
+/* Vectorized filter kernels are built for x86 with GCC compatible compilers
+ * and selected at runtime. Define EBUR128_DISABLE_SIMD to build without them. */
+#if !defined(EBUR128_DISABLE_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+  #define EBUR128_X86_SIMD
+  #include <immintrin.h>
 #endif
 
 #define CHECK_ERROR(condition, errorcode, goto_point)                          \
@@ -21,19 +28,54 @@
     goto goto_point;                                                           \
   }
 
-SLIST_HEAD(ebur128_double_queue, ebur128_dq_entry);
-struct ebur128_dq_entry {
-  double z;
-  SLIST_ENTRY(ebur128_dq_entry) entries;
+/* Taps of each phase of the true peak interpolation filter, 48 taps at 4x
+ * oversampling like the example filter of ITU-R BS.1770-4. */
+#define EBUR128_TP_TAPS 12
+
+/* Block energies are kept in chunks of this many values, 51.2s of gating
+ * blocks. */
+#define EBUR128_DQ_CHUNK_SIZE 512
+
+SLIST_HEAD(ebur128_double_queue, ebur128_dq_chunk);
+struct ebur128_dq_chunk {
+  size_t used;
+  double z[EBUR128_DQ_CHUNK_SIZE];
+  SLIST_ENTRY(ebur128_dq_chunk) entries;
+};
+
+/* Decimation by a power of two, in half-band stages that each halve the
+ * rate. Only the center tap and the odd taps around it are nonzero, so the
+ * even input samples go through the taps in pairs and the odd ones only
+ * through the center. */
+#define EBUR128_HALFBAND_PAIRS 16
+#define EBUR128_MAX_HALFBANDS 4
+
+struct ebur128_halfband {
+  /** Nonzero taps on each side of the center. */
+  size_t pairs;
+  float center;
+  /** h[j] is the tap 2 * j + 1 samples away from the center. */
+  float h[EBUR128_HALFBAND_PAIRS];
+  /** Even and odd input samples of each channel, one array of capacity
+   *  samples each, in the order even and odd of channel 0, then channel 1. */
+  float* buffer;
+  size_t capacity;
+  /** Samples in each even and each odd array, including the history. */
+  size_t evens;
+  size_t odds;
 };
 
 struct ebur128_state_internal {
-  /** Filtered audio data (used as ring buffer). */
+  /** Energy of the filtered audio, one channel weighted sum per frame (used
+   *  as ring buffer). */
   double* audio_data;
-  /** Size of audio_data array. */
+  /** Size of audio_data array in frames. */
   size_t audio_data_frames;
-  /** Current index for audio_data. */
+  /** Current frame index for audio_data. */
   size_t audio_data_index;
+  /** Sums of each 100ms of audio_data, the one at audio_data_index is still
+   *  being added up. Stored after audio_data in the same allocation. */
+  double* partial_energy;
   /** How many frames are needed for a gating block. Will correspond to 400ms
    *  of audio at initialization, and 100ms after the first block (75% overlap
    *  as specified in the 2011 revision of BS1770). */
@@ -48,10 +90,18 @@ struct ebur128_state_internal {
   double a[5];
   /** BS.1770 filter state. */
   double v[5][5];
-  /** Linked list of block energies. */
+  /** The same filter as two biquads (pre-filter and RLB filter) in single
+   *  precision, nominator and denominator. */
+  float sb[2][3];
+  float sa[2][3];
+  /** Single precision filter state, two values per biquad. */
+  float sv[5][2][2];
+  /** Block energies, the newest chunk first. */
   struct ebur128_double_queue block_list;
-  /** Linked list of 3s-block energies, used to calculate LRA. */
+  /** 3s-block energies, used to calculate LRA. */
   struct ebur128_double_queue short_term_block_list;
+  /** Emptied chunks of both lists, kept for the next measurement. */
+  struct ebur128_double_queue spare_chunks;
   int use_histogram;
   unsigned long *block_energy_histogram;
   unsigned long *short_term_block_energy_histogram;
@@ -61,32 +111,122 @@ struct ebur128_state_internal {
   double* sample_peak;
   /** Maximum true peak, one per channel */
   double* true_peak;
-#ifdef USE_SPEEX_RESAMPLER
-  SpeexResamplerState* resampler;
-#endif
+  /** Oversampling factor for true peak, 1 if the samplerate is high enough
+   *  to use the sample peak. */
   size_t oversample_factor;
-  float* resampler_buffer_input;
-  size_t resampler_buffer_input_frames;
-  float* resampler_buffer_output;
-  size_t resampler_buffer_output_frames;
+  /** Polyphase interpolation filter, one row of taps per output phase. */
+  float tp_coef[4][EBUR128_TP_TAPS];
+  /** The last EBUR128_TP_TAPS - 1 samples of each channel. */
+  float* tp_history;
+  /** History and new samples of the channel being interpolated. */
+  float* tp_buffer;
+  /** Widest SIMD instruction set the filter may use, see ebur128_simd. */
+  int simd;
+  /** Channels with a filter state of their own, in channel order, with the
+   *  index of that state and their weight. 0 lanes if two channels share a
+   *  state. Updated whenever the channel map changes. */
+  size_t lanes;
+  size_t lane_channel[5];
+  int lane_ci[5];
+  double lane_weight[5];
+  /** Filter kernel for the channel layout, see ebur128_init_kernel. */
+  int kernel;
+  /** Decimation factor (EBUR128_MODE_DECIMATE), 1 if the input is filtered
+   *  as is. samples_in_100ms and the filter are for the decimated rate. */
+  size_t decimation;
+  struct ebur128_halfband halfband[EBUR128_MAX_HALFBANDS];
+  size_t halfbands;
+  /** Output of the stages, one array per channel. */
+  float* decimated;
+  const float** decimated_planes;
 };
 
 static double relative_gate = -10.0;
 
-/* Those will be calculated when initializing the library */
+/* Those will be calculated once, by the first ebur128_init */
 static double relative_gate_factor;
 static double minus_twenty_decibels;
 static double histogram_energies[1000];
 static double histogram_energy_boundaries[1001];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
 
-static void ebur128_init_filter(ebur128_state* st) {
+/* Filter coefficients of the last samplerates states were created for */
+#define EBUR128_FILTER_CACHE_SIZE 8
+struct ebur128_filter_coefficients {
+  unsigned long samplerate;
+  double b[5];
+  double a[5];
+  float sb[2][3];
+  float sa[2][3];
+};
+static struct ebur128_filter_coefficients
+    filter_cache[EBUR128_FILTER_CACHE_SIZE];
+static size_t filter_cache_size;
+static size_t filter_cache_next;
+static pthread_mutex_t filter_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void ebur128_init_tables(void) {
+  int i;
+
+  relative_gate_factor = pow(10.0, relative_gate / 10.0);
+  minus_twenty_decibels = pow(10.0, -20.0 / 10.0);
+  histogram_energy_boundaries[0] = pow(10.0, (-70.0 + 0.691) / 10.0);
+  for (i = 0; i < 1000; ++i) {
+    histogram_energies[i] = pow(10.0, ((double) i / 10.0 - 69.95 + 0.691) / 10.0);
+  }
+  for (i = 1; i < 1001; ++i) {
+    histogram_energy_boundaries[i] = pow(10.0, ((double) i / 10.0 - 70.0 + 0.691) / 10.0);
+  }
+}
+
+enum {
+  EBUR128_SIMD_NONE = 0,
+  EBUR128_SIMD_SSE2,
+  EBUR128_SIMD_AVX2,
+  EBUR128_SIMD_AVX512
+};
+
+enum {
+  EBUR128_KERNEL_GENERIC = 0,
+  EBUR128_KERNEL_MONO,
+  EBUR128_KERNEL_STEREO,
+  EBUR128_KERNEL_SURROUND
+};
+
+static int ebur128_simd(void) {
+#ifdef EBUR128_X86_SIMD
+  if (__builtin_cpu_supports("avx512f")) return EBUR128_SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2"))    return EBUR128_SIMD_AVX2;
+  if (__builtin_cpu_supports("sse2"))    return EBUR128_SIMD_SSE2;
+#endif
+  return EBUR128_SIMD_NONE;
+}
+
+static void ebur128_reset_filter(ebur128_state* st) {
   int i, j;
 
+  for (i = 0; i < 5; ++i) {
+    for (j = 0; j < 5; ++j) {
+      st->d->v[i][j] = 0.0;
+    }
+  }
+  for (i = 0; i < 5; ++i) {
+    for (j = 0; j < 2; ++j) {
+      st->d->sv[i][j][0] = 0.0f;
+      st->d->sv[i][j][1] = 0.0f;
+    }
+  }
+}
+
+static void ebur128_design_filter(ebur128_state* st) {
+  int i;
+
   double f0 = 1681.974450955533;
   double G  =    3.999843853973347;
   double Q  =    0.7071752369554196;
 
-  double K  = tan(M_PI * f0 / (double) st->samplerate);
+  double rate = (double) (st->samplerate / st->d->decimation);
+  double K  = tan(M_PI * f0 / rate);
   double Vh = pow(10.0, G / 20.0);
   double Vb = pow(Vh, 0.4996667741545416);
 
@@ -107,7 +247,7 @@ static void ebur128_init_filter(ebur128_state* st) {
 
   f0 = 38.13547087602444;
   Q  =  0.5003270373238773;
-  K  = tan(M_PI * f0 / (double) st->samplerate);
+  K  = tan(M_PI * f0 / rate);
 
   ra[1] =   2.0 * (K * K - 1.0) / (1.0 + K / Q + K * K);
   ra[2] = (1.0 - K / Q + K * K) / (1.0 + K / Q + K * K);
@@ -126,17 +266,98 @@ static void ebur128_init_filter(ebur128_state* st) {
   st->d->a[3] = pa[1] * ra[2] + pa[2] * ra[1];
   st->d->a[4] = pa[2] * ra[2];
 
-  for (i = 0; i < 5; ++i) {
-    for (j = 0; j < 5; ++j) {
-      st->d->v[i][j] = 0.0;
+  for (i = 0; i < 3; ++i) {
+    st->d->sb[0][i] = (float) pb[i];
+    st->d->sa[0][i] = (float) pa[i];
+    st->d->sb[1][i] = (float) rb[i];
+    st->d->sa[1][i] = (float) ra[i];
+  }
+}
+
+static void ebur128_init_filter(ebur128_state* st) {
+  struct ebur128_filter_coefficients* c = NULL;
+  unsigned long rate = st->samplerate / st->d->decimation;
+  size_t i;
+
+  pthread_mutex_lock(&filter_cache_mutex);
+  for (i = 0; i < filter_cache_size; ++i) {
+    if (filter_cache[i].samplerate == rate) {
+      c = &filter_cache[i];
+      break;
+    }
+  }
+  if (c) {
+    memcpy(st->d->b, c->b, sizeof(c->b));
+    memcpy(st->d->a, c->a, sizeof(c->a));
+    memcpy(st->d->sb, c->sb, sizeof(c->sb));
+    memcpy(st->d->sa, c->sa, sizeof(c->sa));
+  } else {
+    ebur128_design_filter(st);
+    if (filter_cache_size < EBUR128_FILTER_CACHE_SIZE) {
+      c = &filter_cache[filter_cache_size++];
+    } else {
+      c = &filter_cache[filter_cache_next];
+      filter_cache_next = (filter_cache_next + 1) % EBUR128_FILTER_CACHE_SIZE;
     }
+    c->samplerate = rate;
+    memcpy(c->b, st->d->b, sizeof(c->b));
+    memcpy(c->a, st->d->a, sizeof(c->a));
+    memcpy(c->sb, st->d->sb, sizeof(c->sb));
+    memcpy(c->sa, st->d->sa, sizeof(c->sa));
   }
+  pthread_mutex_unlock(&filter_cache_mutex);
+
+  ebur128_reset_filter(st);
 }
 
-static int ebur128_init_channel_map(ebur128_state* st) {
+static double ebur128_channel_weight(int channel) {
+  if (channel == EBUR128_LEFT_SURROUND ||
+      channel == EBUR128_RIGHT_SURROUND) {
+    return 1.41;
+  } else if (channel == EBUR128_DUAL_MONO) {
+    return 2.0;
+  }
+  return 1.0;
+}
+
+/* Picks the filter kernel once per channel map instead of on every call. Mono,
+ * stereo and 5.1 with every channel measured have kernels of their own, all
+ * other layouts go through the generic loops. */
+static void ebur128_init_kernel(ebur128_state* st) {
+  size_t lanes = 0;
+  unsigned int c;
+  int used[5] = {0, 0, 0, 0, 0};
+  for (c = 0; c < st->channels; ++c) {
+    int i = st->d->channel_map[c] - 1;
+    if (i < 0) continue;
+    else if (i > 4) i = 0; /* dual mono */
+    if (used[i]) {
+      lanes = 0;
+      break;
+    }
+    used[i] = 1;
+    st->d->lane_channel[lanes] = c;
+    st->d->lane_ci[lanes] = i;
+    st->d->lane_weight[lanes] =
+        ebur128_channel_weight(st->d->channel_map[c]);
+    ++lanes;
+  }
+  st->d->lanes = lanes;
+  if (st->channels == 1 && lanes == 1) {
+    st->d->kernel = EBUR128_KERNEL_MONO;
+  } else if (st->channels == 2 && lanes == 2 &&
+             st->d->simd >= EBUR128_SIMD_SSE2) {
+    st->d->kernel = EBUR128_KERNEL_STEREO;
+  } else if (st->channels == 6 && lanes == 5 &&
+             st->d->simd >= EBUR128_SIMD_AVX2) {
+    st->d->kernel = EBUR128_KERNEL_SURROUND;
+  } else {
+    st->d->kernel = EBUR128_KERNEL_GENERIC;
+  }
+}
+
+static void ebur128_default_channel_map(ebur128_state* st) {
   size_t i;
-  st->d->channel_map = (int*) malloc(st->channels * sizeof(int));
-  if (!st->d->channel_map) return EBUR128_ERROR_NOMEM;
   if (st->channels == 4) {
     st->d->channel_map[0] = EBUR128_LEFT;
     st->d->channel_map[1] = EBUR128_RIGHT;
@@ -161,67 +382,184 @@ static int ebur128_init_channel_map(ebur128_state* st) {
       }
     }
   }
+  ebur128_init_kernel(st);
+}
+
+static int ebur128_init_channel_map(ebur128_state* st) {
+  st->d->channel_map = (int*) malloc(st->channels * sizeof(int));
+  if (!st->d->channel_map) return EBUR128_ERROR_NOMEM;
+  ebur128_default_channel_map(st);
   return EBUR128_SUCCESS;
 }
 
-#ifdef USE_SPEEX_RESAMPLER
-static int ebur128_init_resampler(ebur128_state* st) {
-  int errcode = EBUR128_SUCCESS;
+static int ebur128_init_true_peak(ebur128_state* st) {
+  size_t factor, taps, n, p, k;
+  double sum;
 
-  if (st->samplerate < 96000) {
-    st->d->oversample_factor = 4;
-  } else if (st->samplerate < 192000) {
-    st->d->oversample_factor = 2;
-  } else {
+  st->d->tp_history = NULL;
+  st->d->tp_buffer = NULL;
+  if ((st->mode & EBUR128_MODE_TRUE_PEAK) != EBUR128_MODE_TRUE_PEAK ||
+      st->samplerate >= 192000) {
     st->d->oversample_factor = 1;
-    st->d->resampler_buffer_input = NULL;
-    st->d->resampler_buffer_output = NULL;
-    st->d->resampler = NULL;
+    return EBUR128_SUCCESS;
+  }
+  st->d->oversample_factor = st->samplerate < 96000 ? 4 : 2;
+
+  /* Hann windowed sinc with its cutoff at the original Nyquist frequency,
+   * centered on a sample so phase p interpolates p / factor samples after
+   * it. Each phase is normalized to unity gain at DC. */
+  factor = st->d->oversample_factor;
+  taps = EBUR128_TP_TAPS * factor;
+  for (p = 0; p < factor; ++p) {
+    sum = 0.0;
+    for (k = 0; k < EBUR128_TP_TAPS; ++k) {
+      double t, h;
+      n = (EBUR128_TP_TAPS - 1 - k) * factor + p;
+      t = ((double) n - (double) taps / 2.0) / (double) factor;
+      h = t == 0.0 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+      h *= 0.5 * (1.0 - cos(2.0 * M_PI * (double) n / (double) taps));
+      st->d->tp_coef[p][k] = (float) h;
+      sum += h;
+    }
+    for (k = 0; k < EBUR128_TP_TAPS; ++k) {
+      st->d->tp_coef[p][k] = (float) (st->d->tp_coef[p][k] / sum);
+    }
   }
 
-  st->d->resampler_buffer_input_frames = st->d->samples_in_100ms * 4;
-  st->d->resampler_buffer_input = malloc(st->d->resampler_buffer_input_frames *
-                                      st->channels *
+  st->d->tp_history = (float*) calloc(st->channels * (EBUR128_TP_TAPS - 1),
                                       sizeof(float));
-  CHECK_ERROR(!st->d->resampler_buffer_input, EBUR128_ERROR_NOMEM, exit)
-
-  st->d->resampler_buffer_output_frames =
-                                    st->d->resampler_buffer_input_frames *
-                                    st->d->oversample_factor;
-  st->d->resampler_buffer_output = malloc
-                                      (st->d->resampler_buffer_output_frames *
-                                       st->channels *
-                                       sizeof(float));
-  CHECK_ERROR(!st->d->resampler_buffer_output, EBUR128_ERROR_NOMEM, free_input)
-
-  st->d->resampler = speex_resampler_init
-                 ((spx_uint32_t) st->channels,
-                  (spx_uint32_t) st->samplerate,
-                  (spx_uint32_t) (st->samplerate * st->d->oversample_factor),
-                  8, NULL);
-  CHECK_ERROR(!st->d->resampler, EBUR128_ERROR_NOMEM, free_output)
-
-  return errcode;
-
-free_output:
-  free(st->d->resampler_buffer_output);
-  st->d->resampler_buffer_output = NULL;
-free_input:
-  free(st->d->resampler_buffer_input);
-  st->d->resampler_buffer_input = NULL;
-exit:
-  return errcode;
+  if (!st->d->tp_history) return EBUR128_ERROR_NOMEM;
+  st->d->tp_buffer = (float*) malloc((st->d->samples_in_100ms * 4 +
+                                      EBUR128_TP_TAPS - 1) * sizeof(float));
+  if (!st->d->tp_buffer) {
+    free(st->d->tp_history);
+    st->d->tp_history = NULL;
+    return EBUR128_ERROR_NOMEM;
+  }
+  return EBUR128_SUCCESS;
 }
 
-static void ebur128_destroy_resampler(ebur128_state* st) {
-  free(st->d->resampler_buffer_input);
-  st->d->resampler_buffer_input = NULL;
-  free(st->d->resampler_buffer_output);
-  st->d->resampler_buffer_output = NULL;
-  speex_resampler_destroy(st->d->resampler);
-  st->d->resampler = NULL;
+static void ebur128_destroy_true_peak(ebur128_state* st) {
+  free(st->d->tp_history);
+  st->d->tp_history = NULL;
+  free(st->d->tp_buffer);
+  st->d->tp_buffer = NULL;
+}
+
+/* Largest power of two the samplerate can be divided by without going below
+ * 44.1 kHz, 1 if EBUR128_MODE_DECIMATE is not set. */
+static size_t ebur128_decimation(int mode, unsigned long samplerate) {
+  size_t factor = 1;
+  if ((mode & EBUR128_MODE_DECIMATE) != EBUR128_MODE_DECIMATE) return 1;
+  while (factor < (1 << EBUR128_MAX_HALFBANDS) &&
+         samplerate % (2 * factor) == 0 &&
+         samplerate / (2 * factor) >= 44100) {
+    factor *= 2;
+  }
+  return factor;
+}
+
+static double ebur128_bessel_i0(double x) {
+  double sum = 1.0, term = 1.0;
+  int k;
+  for (k = 1; k < 100 && term > 1e-15 * sum; ++k) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+/* The stages start with half a filter length of silence, which centers the
+ * first output on the first sample. */
+static void ebur128_reset_decimator(ebur128_state* st) {
+  size_t s;
+  for (s = 0; s < st->d->halfbands; ++s) {
+    struct ebur128_halfband* hb = &st->d->halfband[s];
+    hb->evens = hb->pairs;
+    hb->odds = hb->pairs - 1;
+    memset(hb->buffer, 0, 2 * st->channels * hb->capacity * sizeof(float));
+  }
+}
+
+static void ebur128_destroy_decimator(ebur128_state* st) {
+  size_t s;
+  for (s = 0; s < EBUR128_MAX_HALFBANDS; ++s) {
+    free(st->d->halfband[s].buffer);
+    st->d->halfband[s].buffer = NULL;
+  }
+  free(st->d->decimated);
+  st->d->decimated = NULL;
+  free(st->d->decimated_planes);
+  st->d->decimated_planes = NULL;
+  st->d->halfbands = 0;
+}
+
+static int ebur128_init_decimator(ebur128_state* st) {
+  unsigned long rate = st->samplerate;
+  unsigned long out_rate = st->samplerate / st->d->decimation;
+  /* 20 kHz at 48 kHz, the images of everything below have to be removed */
+  double passband = (double) out_rate * 5.0 / 12.0;
+  /* Kaiser window for 60 dB stopband attenuation */
+  double attenuation = 60.0;
+  double beta = 0.1102 * (attenuation - 8.7);
+  size_t frames = st->d->samples_in_100ms * 4;
+  size_t s, j, c;
+
+  for (s = 0; s < EBUR128_MAX_HALFBANDS; ++s) {
+    st->d->halfband[s].buffer = NULL;
+  }
+  st->d->decimated = NULL;
+  st->d->decimated_planes = NULL;
+  st->d->halfbands = 0;
+  if (st->d->decimation == 1) return EBUR128_SUCCESS;
+
+  for (s = 0; rate > out_rate; ++s, rate /= 2) {
+    struct ebur128_halfband* hb = &st->d->halfband[s];
+    /* the transition band lies between the passband and its image around
+     * rate / 4, which is wide in all but the last stage */
+    double width = ((double) rate / 2.0 - 2.0 * passband) / (double) rate;
+    double half = (attenuation - 7.95) / (14.36 * width) / 2.0;
+    double h[EBUR128_HALFBAND_PAIRS];
+    double sum = 0.5, m;
+    hb->pairs = (size_t) ceil((half + 1.0) / 2.0);
+    if (hb->pairs > EBUR128_HALFBAND_PAIRS) hb->pairs = EBUR128_HALFBAND_PAIRS;
+    m = (double) (2 * hb->pairs - 1);
+    for (j = 0; j < hb->pairs; ++j) {
+      double n = (double) (2 * j + 1);
+      h[j] = sin(M_PI * n / 2.0) / (M_PI * n);
+      h[j] *= ebur128_bessel_i0(beta * sqrt(1.0 - (n / m) * (n / m))) /
+              ebur128_bessel_i0(beta);
+      sum += 2.0 * h[j];
+    }
+    /* unity gain at DC */
+    hb->center = (float) (0.5 / sum);
+    for (j = 0; j < hb->pairs; ++j) {
+      hb->h[j] = (float) (h[j] / sum);
+    }
+    hb->capacity = 2 * hb->pairs + frames / 2 + 1;
+    hb->buffer = (float*) malloc(2 * st->channels * hb->capacity *
+                                 sizeof(float));
+    if (!hb->buffer) {
+      ebur128_destroy_decimator(st);
+      return EBUR128_ERROR_NOMEM;
+    }
+    ++st->d->halfbands;
+    frames = frames / 2 + 1;
+  }
+  frames = st->d->samples_in_100ms * 2;
+  st->d->decimated = (float*) malloc(st->channels * frames * sizeof(float));
+  st->d->decimated_planes =
+      (const float**) malloc(st->channels * sizeof(float*));
+  if (!st->d->decimated || !st->d->decimated_planes) {
+    ebur128_destroy_decimator(st);
+    return EBUR128_ERROR_NOMEM;
+  }
+  for (c = 0; c < st->channels; ++c) {
+    st->d->decimated_planes[c] = st->d->decimated + c * frames;
+  }
+  ebur128_reset_decimator(st);
+  return EBUR128_SUCCESS;
 }
-#endif
 
 void ebur128_get_version(int* major, int* minor, int* patch) {
   *major = EBUR128_VERSION_MAJOR;
@@ -236,12 +574,16 @@ ebur128_state* ebur128_init(unsigned int channels,
   ebur128_state* st;
   unsigned int i;
 
+  /* initialize static constants */
+  pthread_once(&tables_once, ebur128_init_tables);
+
   st = (ebur128_state*) malloc(sizeof(ebur128_state));
   CHECK_ERROR(!st, 0, exit)
   st->d = (struct ebur128_state_internal*)
           malloc(sizeof(struct ebur128_state_internal));
   CHECK_ERROR(!st->d, 0, free_state)
   st->channels = channels;
+  st->d->simd = ebur128_simd();
   errcode = ebur128_init_channel_map(st);
   CHECK_ERROR(errcode, 0, free_internal)
 
@@ -257,7 +599,8 @@ ebur128_state* ebur128_init(unsigned int channels,
   st->d->use_histogram = mode & EBUR128_MODE_HISTOGRAM ? 1 : 0;
 
   st->samplerate = samplerate;
-  st->d->samples_in_100ms = (st->samplerate + 5) / 10;
+  st->d->decimation = ebur128_decimation(mode, samplerate);
+  st->d->samples_in_100ms = (st->samplerate / st->d->decimation + 5) / 10;
   st->mode = mode;
   if ((mode & EBUR128_MODE_S) == EBUR128_MODE_S) {
     st->d->audio_data_frames = st->d->samples_in_100ms * 30;
@@ -267,9 +610,12 @@ ebur128_state* ebur128_init(unsigned int channels,
     goto free_true_peak;
   }
   st->d->audio_data = (double*) malloc(st->d->audio_data_frames *
-                                       st->channels *
+                                       sizeof(double) +
+                                       st->d->audio_data_frames /
+                                       st->d->samples_in_100ms *
                                        sizeof(double));
   CHECK_ERROR(!st->d->audio_data, 0, free_true_peak)
+  st->d->partial_energy = st->d->audio_data + st->d->audio_data_frames;
   ebur128_init_filter(st);
 
   if (st->d->use_histogram) {
@@ -292,33 +638,23 @@ ebur128_state* ebur128_init(unsigned int channels,
   }
   SLIST_INIT(&st->d->block_list);
   SLIST_INIT(&st->d->short_term_block_list);
+  SLIST_INIT(&st->d->spare_chunks);
   st->d->short_term_frame_counter = 0;
 
-#ifdef USE_SPEEX_RESAMPLER
-  result = ebur128_init_resampler(st);
+  result = ebur128_init_true_peak(st);
   CHECK_ERROR(result, 0, free_short_term_block_energy_histogram)
-#endif
+  result = ebur128_init_decimator(st);
+  CHECK_ERROR(result, 0, destroy_true_peak)
 
   /* the first block needs 400ms of audio data */
   st->d->needed_frames = st->d->samples_in_100ms * 4;
   /* start at the beginning of the buffer */
   st->d->audio_data_index = 0;
 
-  /* initialize static constants */
-  relative_gate_factor = pow(10.0, relative_gate / 10.0);
-  minus_twenty_decibels = pow(10.0, -20.0 / 10.0);
-  histogram_energy_boundaries[0] = pow(10.0, (-70.0 + 0.691) / 10.0);
-  if (st->d->use_histogram) {
-    for (i = 0; i < 1000; ++i) {
-      histogram_energies[i] = pow(10.0, ((double) i / 10.0 - 69.95 + 0.691) / 10.0);
-    }
-    for (i = 1; i < 1001; ++i) {
-      histogram_energy_boundaries[i] = pow(10.0, ((double) i / 10.0 - 70.0 + 0.691) / 10.0);
-    }
-  }
-
   return st;
 
+destroy_true_peak:
+  ebur128_destroy_true_peak(st);
 free_short_term_block_energy_histogram:
   free(st->d->short_term_block_energy_histogram);
 free_block_energy_histogram:
@@ -339,67 +675,75 @@ exit:
   return NULL;
 }
 
+static int ebur128_dq_push(struct ebur128_double_queue* queue,
+                           struct ebur128_double_queue* spare, double z) {
+  struct ebur128_dq_chunk* chunk = SLIST_FIRST(queue);
+  if (!chunk || chunk->used == EBUR128_DQ_CHUNK_SIZE) {
+    if (!SLIST_EMPTY(spare)) {
+      chunk = SLIST_FIRST(spare);
+      SLIST_REMOVE_HEAD(spare, entries);
+    } else {
+      chunk = (struct ebur128_dq_chunk*)
+              malloc(sizeof(struct ebur128_dq_chunk));
+      if (!chunk) return EBUR128_ERROR_NOMEM;
+    }
+    chunk->used = 0;
+    SLIST_INSERT_HEAD(queue, chunk, entries);
+  }
+  chunk->z[chunk->used++] = z;
+  return EBUR128_SUCCESS;
+}
+
+/* Empties queue, moving its chunks to spare or freeing them if it is NULL. */
+static void ebur128_dq_clear(struct ebur128_double_queue* queue,
+                             struct ebur128_double_queue* spare) {
+  struct ebur128_dq_chunk* chunk;
+  while (!SLIST_EMPTY(queue)) {
+    chunk = SLIST_FIRST(queue);
+    SLIST_REMOVE_HEAD(queue, entries);
+    if (spare) {
+      SLIST_INSERT_HEAD(spare, chunk, entries);
+    } else {
+      free(chunk);
+    }
+  }
+}
+
 void ebur128_destroy(ebur128_state** st) {
-  struct ebur128_dq_entry* entry;
   free((*st)->d->block_energy_histogram);
   free((*st)->d->short_term_block_energy_histogram);
   free((*st)->d->audio_data);
   free((*st)->d->channel_map);
   free((*st)->d->sample_peak);
   free((*st)->d->true_peak);
-  while (!SLIST_EMPTY(&(*st)->d->block_list)) {
-    entry = SLIST_FIRST(&(*st)->d->block_list);
-    SLIST_REMOVE_HEAD(&(*st)->d->block_list, entries);
-    free(entry);
-  }
-  while (!SLIST_EMPTY(&(*st)->d->short_term_block_list)) {
-    entry = SLIST_FIRST(&(*st)->d->short_term_block_list);
-    SLIST_REMOVE_HEAD(&(*st)->d->short_term_block_list, entries);
-    free(entry);
-  }
-#ifdef USE_SPEEX_RESAMPLER
-  ebur128_destroy_resampler(*st);
-#endif
+  ebur128_dq_clear(&(*st)->d->block_list, NULL);
+  ebur128_dq_clear(&(*st)->d->short_term_block_list, NULL);
+  ebur128_dq_clear(&(*st)->d->spare_chunks, NULL);
+  ebur128_destroy_true_peak(*st);
+  ebur128_destroy_decimator(*st);
 
   free((*st)->d);
   free(*st);
   *st = NULL;
 }
 
-static int ebur128_use_speex_resampler(ebur128_state* st) {
-#ifdef USE_SPEEX_RESAMPLER
-  return ((st->mode & EBUR128_MODE_TRUE_PEAK) == EBUR128_MODE_TRUE_PEAK);
-#else
-  (void) st;
-  return 0;
-#endif
-}
-
-static void ebur128_check_true_peak(ebur128_state* st, size_t frames) {
-#ifdef USE_SPEEX_RESAMPLER
-  size_t c, i;
-  spx_uint32_t in_len = (spx_uint32_t) frames;
-  spx_uint32_t out_len = (spx_uint32_t) st->d->resampler_buffer_output_frames;
-  speex_resampler_process_interleaved_float(
-                      st->d->resampler,
-                      st->d->resampler_buffer_input,  &in_len,
-                      st->d->resampler_buffer_output, &out_len);
-  for (c = 0; c < st->channels; ++c) {
-    for (i = 0; i < out_len; ++i) {
-      if (st->d->resampler_buffer_output[i * st->channels + c] >
-                                                         st->d->true_peak[c]) {
-        st->d->true_peak[c] =
-            st->d->resampler_buffer_output[i * st->channels + c];
-      } else if (-st->d->resampler_buffer_output[i * st->channels + c] >
-                                                         st->d->true_peak[c]) {
-        st->d->true_peak[c] =
-           -st->d->resampler_buffer_output[i * st->channels + c];
-      }
+int ebur128_discard_measurements(ebur128_state* st) {
+  unsigned int i;
+  ebur128_dq_clear(&st->d->block_list, &st->d->spare_chunks);
+  ebur128_dq_clear(&st->d->short_term_block_list, &st->d->spare_chunks);
+  if (st->d->use_histogram) {
+    for (i = 0; i < 1000; ++i) {
+      st->d->block_energy_histogram[i] = 0;
+      st->d->short_term_block_energy_histogram[i] = 0;
     }
   }
-#else
-  (void) st; (void) frames;
-#endif
+  for (i = 0; i < st->channels; ++i) {
+    st->d->sample_peak[i] = 0.0;
+    st->d->true_peak[i] = 0.0;
+  }
+  /* the next short-term block ends 3s from here, as in a fresh measurement */
+  st->d->short_term_frame_counter %= st->d->samples_in_100ms;
+  return EBUR128_SUCCESS;
 }
 
 #ifdef __SSE2_MATH__
@@ -409,6 +753,7 @@ static void ebur128_check_true_peak(ebur128_state* st, size_t frames) {
         _mm_setcsr(mxcsr | _MM_FLUSH_ZERO_ON);
 #define TURN_OFF_FTZ _mm_setcsr(mxcsr);
 #define FLUSH_MANUALLY
+#define FLUSH_MANUALLY_SINGLE
 #else
 #warning "manual FTZ is being used, please enable SSE2 (-msse2 -mfpmath=sse)"
 #define TURN_ON_FTZ
@@ -418,64 +763,822 @@ static void ebur128_check_true_peak(ebur128_state* st, size_t frames) {
     st->d->v[ci][3] = fabs(st->d->v[ci][3]) < DBL_MIN ? 0.0 : st->d->v[ci][3]; \
     st->d->v[ci][2] = fabs(st->d->v[ci][2]) < DBL_MIN ? 0.0 : st->d->v[ci][2]; \
     st->d->v[ci][1] = fabs(st->d->v[ci][1]) < DBL_MIN ? 0.0 : st->d->v[ci][1];
+#define FLUSH_MANUALLY_SINGLE \
+    for (k = 0; k < 4; ++k) { \
+      if (fabsf(z[k]) < FLT_MIN) z[k] = 0.0f; \
+    }
 #endif
 
-#define EBUR128_FILTER(type, min_scale, max_scale)                             \
-static void ebur128_filter_##type(ebur128_state* st, const type* src,          \
-                                  size_t frames) {                             \
-  static double scaling_factor = -((double) min_scale) > (double) max_scale ?  \
-                                 -((double) min_scale) : (double) max_scale;   \
-  double* audio_data = st->d->audio_data + st->d->audio_data_index;            \
-  size_t i, c;                                                                 \
+/* Input is either interleaved (src) or one array per channel (planes), offset
+ * is in frames. */
+#define EBUR128_SOURCE(st, src, planes, offset, c)                             \
+  ((planes) ? (planes)[c] + (offset) : (src) + (offset) * (st)->channels + (c))
+
+/* Filtering is recursive in time, so the kernels below process up to 2, 4 or
+ * 8 channels at once, one per vector lane. They do the same operations in the
+ * same order as the scalar loop, so the output is bit identical to it. The
+ * scaling factors are powers of two, which makes multiplying by the reciprocal
+ * exact as well. */
+#ifdef EBUR128_X86_SIMD
+/* The input is built in registers, storing the samples one by one and
+ * loading them as a vector stalls on store forwarding. */
+#define EBUR128_LANE(s, i, l) ((double) (s)[l][i])
+#define EBUR128_GATHER_SSE2(s, i) \
+  _mm_set_pd(EBUR128_LANE(s, i, 1), EBUR128_LANE(s, i, 0))
+#define EBUR128_GATHER_AVX2(s, i) \
+  _mm256_set_pd(EBUR128_LANE(s, i, 3), EBUR128_LANE(s, i, 2), \
+                EBUR128_LANE(s, i, 1), EBUR128_LANE(s, i, 0))
+#define EBUR128_GATHER_AVX512(s, i) \
+  _mm512_set_pd(EBUR128_LANE(s, i, 7), EBUR128_LANE(s, i, 6), \
+                EBUR128_LANE(s, i, 5), EBUR128_LANE(s, i, 4), \
+                EBUR128_LANE(s, i, 3), EBUR128_LANE(s, i, 2), \
+                EBUR128_LANE(s, i, 1), EBUR128_LANE(s, i, 0))
+#define EBUR128_FILTER_LANES(type, isa, features, width, vd, set1, gather,     \
+                             loadu, storeu, add, sub, mul)                     \
+__attribute__((target(features)))                                              \
+static void ebur128_filter_lanes_##type##_##isa(ebur128_state* st,             \
+                                                const type* const* lane_src,   \
+                                                size_t stride,                 \
+                                                size_t frames,                 \
+                                                double* energy,                \
+                                                const double* lane_weight,     \
+                                                const int* lane_ci,            \
+                                                size_t lanes,                  \
+                                                double scaling_factor) {       \
+  double out[width];                                                           \
+  const type* in[width];                                                       \
+  double v[5][width];                                                          \
+  vd a1 = set1(st->d->a[1]), a2 = set1(st->d->a[2]);                           \
+  vd a3 = set1(st->d->a[3]), a4 = set1(st->d->a[4]);                           \
+  vd b0 = set1(st->d->b[0]), b1 = set1(st->d->b[1]), b2 = set1(st->d->b[2]);   \
+  vd b3 = set1(st->d->b[3]), b4 = set1(st->d->b[4]);                           \
+  vd scale = set1(1.0 / scaling_factor);                                       \
+  vd v0, v1, v2, v3, v4, y, w;                                                 \
+  size_t i, l;                                                                 \
+  int k;                                                                       \
                                                                                \
-  TURN_ON_FTZ                                                                  \
+  for (k = 0; k < 5; ++k) {                                                    \
+    for (l = 0; l < width; ++l) {                                              \
+      v[k][l] = l < lanes ? st->d->v[lane_ci[l]][k] : 0.0;                     \
+    }                                                                          \
+  }                                                                            \
+  v1 = loadu(v[1]); v2 = loadu(v[2]); v3 = loadu(v[3]); v4 = loadu(v[4]);      \
+  for (l = 0; l < width; ++l) {                                                \
+    in[l] = lane_src[l < lanes ? l : 0];                                       \
+    out[l] = l < lanes ? lane_weight[l] : 0.0;                                 \
+  }                                                                            \
+  w = loadu(out);                                                              \
+  for (i = 0; i < frames; ++i) {                                               \
+    v0 = sub(sub(sub(sub(mul(gather(in, i * stride), scale), mul(a1, v1)),     \
+                     mul(a2, v2)), mul(a3, v3)), mul(a4, v4));                 \
+    y = add(add(add(add(mul(b0, v0), mul(b1, v1)), mul(b2, v2)),               \
+                mul(b3, v3)), mul(b4, v4));                                    \
+    storeu(out, mul(w, mul(y, y)));                                            \
+    for (l = 0; l < lanes; ++l) energy[i] += out[l];                           \
+    v4 = v3; v3 = v2; v2 = v1; v1 = v0;                                        \
+  }                                                                            \
+  storeu(v[1], v1); storeu(v[2], v2); storeu(v[3], v3); storeu(v[4], v4);      \
+  for (l = 0; l < lanes; ++l) {                                                \
+    st->d->v[lane_ci[l]][0] = v[1][l];                                         \
+    for (k = 1; k < 5; ++k) {                                                  \
+      st->d->v[lane_ci[l]][k] = v[k][l];                                       \
+    }                                                                          \
+  }                                                                            \
+}
+/* The single precision kernels run each channel through the two biquads in
+ * transposed direct form II, which keeps the recursion short. The scalar
+ * single precision loop does the same operations, so it matches them. */
+#define EBUR128_LANE_SINGLE(s, i, l) ((float) (s)[l][i])
+#define EBUR128_GATHER_SINGLE_SSE2(s, i) \
+  _mm_set_ps(EBUR128_LANE_SINGLE(s, i, 3), EBUR128_LANE_SINGLE(s, i, 2), \
+             EBUR128_LANE_SINGLE(s, i, 1), EBUR128_LANE_SINGLE(s, i, 0))
+#define EBUR128_GATHER_SINGLE_AVX2(s, i) \
+  _mm256_set_ps(EBUR128_LANE_SINGLE(s, i, 7), EBUR128_LANE_SINGLE(s, i, 6), \
+                EBUR128_LANE_SINGLE(s, i, 5), EBUR128_LANE_SINGLE(s, i, 4), \
+                EBUR128_LANE_SINGLE(s, i, 3), EBUR128_LANE_SINGLE(s, i, 2), \
+                EBUR128_LANE_SINGLE(s, i, 1), EBUR128_LANE_SINGLE(s, i, 0))
+#define EBUR128_FILTER_LANES_SINGLE(type, isa, features, width, vf, set1,      \
+                                    gather, loadu, storeu, add, sub, mul)      \
+__attribute__((target(features)))                                              \
+static void ebur128_filter_single_lanes_##type##_##isa(                        \
+    ebur128_state* st, const type* const* lane_src, size_t stride,             \
+    size_t frames, double* energy, const double* lane_weight,                  \
+    const int* lane_ci, size_t lanes, float scale) {                           \
+  float out[width];                                                            \
+  const type* in[width];                                                       \
+  float z[2][2][width];                                                        \
+  vf pb0 = set1(st->d->sb[0][0]), pb1 = set1(st->d->sb[0][1]);                 \
+  vf pb2 = set1(st->d->sb[0][2]);                                              \
+  vf pa1 = set1(st->d->sa[0][1]), pa2 = set1(st->d->sa[0][2]);                 \
+  vf rb0 = set1(st->d->sb[1][0]), rb1 = set1(st->d->sb[1][1]);                 \
+  vf rb2 = set1(st->d->sb[1][2]);                                              \
+  vf ra1 = set1(st->d->sa[1][1]), ra2 = set1(st->d->sa[1][2]);                 \
+  vf x, y0, y, w, sc = set1(scale);                                            \
+  vf p0, p1, r0, r1;                                                           \
+  size_t i, l;                                                                 \
+  int j, k;                                                                    \
                                                                                \
-  if ((st->mode & EBUR128_MODE_SAMPLE_PEAK) == EBUR128_MODE_SAMPLE_PEAK) {     \
-    for (c = 0; c < st->channels; ++c) {                                       \
-      double max = 0.0;                                                        \
-      for (i = 0; i < frames; ++i) {                                           \
-        if (src[i * st->channels + c] > max) {                                 \
-          max =        src[i * st->channels + c];                              \
-        } else if (-src[i * st->channels + c] > max) {                         \
-          max = -1.0 * src[i * st->channels + c];                              \
-        }                                                                      \
+  for (l = 0; l < width; ++l) {                                                \
+    for (j = 0; j < 2; ++j) {                                                  \
+      for (k = 0; k < 2; ++k) {                                                \
+        z[j][k][l] = l < lanes ? st->d->sv[lane_ci[l]][j][k] : 0.0f;           \
       }                                                                        \
-      max /= scaling_factor;                                                   \
-      if (max > st->d->sample_peak[c]) st->d->sample_peak[c] = max;            \
     }                                                                          \
+    in[l] = lane_src[l < lanes ? l : 0];                                       \
+    out[l] = l < lanes ? (float) lane_weight[l] : 0.0f;                        \
   }                                                                            \
-  if (ebur128_use_speex_resampler(st)) {                                       \
-    for (c = 0; c < st->channels; ++c) {                                       \
+  w = loadu(out);                                                              \
+  p0 = loadu(z[0][0]); p1 = loadu(z[0][1]);                                    \
+  r0 = loadu(z[1][0]); r1 = loadu(z[1][1]);                                    \
+  for (i = 0; i < frames; ++i) {                                               \
+    x = mul(gather(in, i * stride), sc);                                       \
+    y0 = add(mul(pb0, x), p0);                                                 \
+    p0 = sub(add(mul(pb1, x), p1), mul(pa1, y0));                              \
+    p1 = sub(mul(pb2, x), mul(pa2, y0));                                       \
+    y = add(mul(rb0, y0), r0);                                                 \
+    r0 = sub(add(mul(rb1, y0), r1), mul(ra1, y));                              \
+    r1 = sub(mul(rb2, y0), mul(ra2, y));                                       \
+    storeu(out, mul(w, mul(y, y)));                                            \
+    for (l = 0; l < lanes; ++l) energy[i] += (double) out[l];                  \
+  }                                                                            \
+  storeu(z[0][0], p0); storeu(z[0][1], p1);                                    \
+  storeu(z[1][0], r0); storeu(z[1][1], r1);                                    \
+  for (l = 0; l < lanes; ++l) {                                                \
+    for (j = 0; j < 2; ++j) {                                                  \
+      for (k = 0; k < 2; ++k) {                                                \
+        st->d->sv[lane_ci[l]][j][k] = z[j][k][l];                              \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+}
+#define EBUR128_FILTER_LANES_ALL(type)                                         \
+EBUR128_FILTER_LANES(type, sse2, "sse2", 2, __m128d, _mm_set1_pd,              \
+                     EBUR128_GATHER_SSE2, _mm_loadu_pd, _mm_storeu_pd,         \
+                     _mm_add_pd, _mm_sub_pd, _mm_mul_pd)                       \
+EBUR128_FILTER_LANES(type, avx2, "avx2", 4, __m256d, _mm256_set1_pd,           \
+                     EBUR128_GATHER_AVX2, _mm256_loadu_pd, _mm256_storeu_pd,   \
+                     _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd)              \
+EBUR128_FILTER_LANES(type, avx512, "avx512f", 8, __m512d, _mm512_set1_pd,      \
+                     EBUR128_GATHER_AVX512, _mm512_loadu_pd, _mm512_storeu_pd, \
+                     _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd)              \
+EBUR128_FILTER_LANES_SINGLE(type, sse2, "sse2", 4, __m128, _mm_set1_ps,        \
+                            EBUR128_GATHER_SINGLE_SSE2, _mm_loadu_ps,          \
+                            _mm_storeu_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps) \
+EBUR128_FILTER_LANES_SINGLE(type, avx2, "avx2", 8, __m256, _mm256_set1_ps,     \
+                            EBUR128_GATHER_SINGLE_AVX2, _mm256_loadu_ps,       \
+                            _mm256_storeu_ps, _mm256_add_ps, _mm256_sub_ps,    \
+                            _mm256_mul_ps)
+EBUR128_FILTER_LANES_ALL(short)
+EBUR128_FILTER_LANES_ALL(int)
+EBUR128_FILTER_LANES_ALL(float)
+EBUR128_FILTER_LANES_ALL(double)
+
+/* Stereo and 5.1 with constant lanes: the energy of a frame is added up in
+ * registers, in the same order as the generic kernels do it. 5.1 runs the
+ * front four channels and the right surround side by side, so their two
+ * recursions overlap instead of taking a pass each. */
+#define EBUR128_FILTER_STEREO(type)                                            \
+__attribute__((target("sse2")))                                                \
+static void ebur128_filter_stereo_##type(ebur128_state* st,                    \
+                                         const type* const* lane_src,          \
+                                         size_t stride, size_t frames,         \
+                                         double scaling_factor) {              \
+  double* energy = st->d->audio_data + st->d->audio_data_index;                \
+  double* s0 = st->d->v[st->d->lane_ci[0]];                                    \
+  double* s1 = st->d->v[st->d->lane_ci[1]];                                    \
+  const type* in0 = lane_src[0];                                               \
+  const type* in1 = lane_src[1];                                               \
+  __m128d a1 = _mm_set1_pd(st->d->a[1]), a2 = _mm_set1_pd(st->d->a[2]);        \
+  __m128d a3 = _mm_set1_pd(st->d->a[3]), a4 = _mm_set1_pd(st->d->a[4]);        \
+  __m128d b0 = _mm_set1_pd(st->d->b[0]), b1 = _mm_set1_pd(st->d->b[1]);        \
+  __m128d b2 = _mm_set1_pd(st->d->b[2]), b3 = _mm_set1_pd(st->d->b[3]);        \
+  __m128d b4 = _mm_set1_pd(st->d->b[4]);                                       \
+  __m128d scale = _mm_set1_pd(1.0 / scaling_factor);                           \
+  __m128d w = _mm_set_pd(st->d->lane_weight[1], st->d->lane_weight[0]);        \
+  __m128d v1 = _mm_set_pd(s1[1], s0[1]), v2 = _mm_set_pd(s1[2], s0[2]);        \
+  __m128d v3 = _mm_set_pd(s1[3], s0[3]), v4 = _mm_set_pd(s1[4], s0[4]);        \
+  __m128d v0, y, e;                                                            \
+  size_t i;                                                                    \
+  for (i = 0; i < frames; ++i) {                                               \
+    __m128d x = _mm_set_pd((double) in1[i * stride], (double) in0[i * stride]);\
+    v0 = _mm_sub_pd(_mm_sub_pd(_mm_sub_pd(_mm_sub_pd(                          \
+             _mm_mul_pd(x, scale), _mm_mul_pd(a1, v1)), _mm_mul_pd(a2, v2)),   \
+             _mm_mul_pd(a3, v3)), _mm_mul_pd(a4, v4));                         \
+    y = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_add_pd(                           \
+            _mm_mul_pd(b0, v0), _mm_mul_pd(b1, v1)), _mm_mul_pd(b2, v2)),      \
+            _mm_mul_pd(b3, v3)), _mm_mul_pd(b4, v4));                          \
+    e = _mm_mul_pd(w, _mm_mul_pd(y, y));                                       \
+    e = _mm_add_sd(_mm_add_sd(_mm_load_sd(energy + i), e),                     \
+                   _mm_unpackhi_pd(e, e));                                     \
+    _mm_store_sd(energy + i, e);                                               \
+    v4 = v3; v3 = v2; v2 = v1; v1 = v0;                                        \
+  }                                                                            \
+  _mm_storel_pd(s0 + 1, v1); _mm_storeh_pd(s1 + 1, v1);                        \
+  _mm_storel_pd(s0 + 2, v2); _mm_storeh_pd(s1 + 2, v2);                        \
+  _mm_storel_pd(s0 + 3, v3); _mm_storeh_pd(s1 + 3, v3);                        \
+  _mm_storel_pd(s0 + 4, v4); _mm_storeh_pd(s1 + 4, v4);                        \
+  s0[0] = s0[1];                                                               \
+  s1[0] = s1[1];                                                               \
+}
+#define EBUR128_FILTER_SURROUND(type)                                          \
+__attribute__((target("avx2")))                                                \
+static void ebur128_filter_surround_##type(ebur128_state* st,                  \
+                                           const type* const* lane_src,        \
+                                           size_t stride, size_t frames,       \
+                                           double scaling_factor) {            \
+  double* energy = st->d->audio_data + st->d->audio_data_index;                \
+  double* s[5];                                                                \
+  const type* in0 = lane_src[0];                                               \
+  const type* in1 = lane_src[1];                                               \
+  const type* in2 = lane_src[2];                                               \
+  const type* in3 = lane_src[3];                                               \
+  const type* in4 = lane_src[4];                                               \
+  double t[5][4];                                                              \
+  __m256d a1 = _mm256_set1_pd(st->d->a[1]), a2 = _mm256_set1_pd(st->d->a[2]);  \
+  __m256d a3 = _mm256_set1_pd(st->d->a[3]), a4 = _mm256_set1_pd(st->d->a[4]);  \
+  __m256d b0 = _mm256_set1_pd(st->d->b[0]), b1 = _mm256_set1_pd(st->d->b[1]);  \
+  __m256d b2 = _mm256_set1_pd(st->d->b[2]), b3 = _mm256_set1_pd(st->d->b[3]);  \
+  __m256d b4 = _mm256_set1_pd(st->d->b[4]);                                    \
+  __m256d scale = _mm256_set1_pd(1.0 / scaling_factor);                        \
+  __m256d w = _mm256_loadu_pd(st->d->lane_weight);                             \
+  __m256d v0, v1, v2, v3, v4, y, e;                                            \
+  double sa1 = st->d->a[1], sa2 = st->d->a[2];                                 \
+  double sa3 = st->d->a[3], sa4 = st->d->a[4];                                 \
+  double sb0 = st->d->b[0], sb1 = st->d->b[1], sb2 = st->d->b[2];              \
+  double sb3 = st->d->b[3], sb4 = st->d->b[4];                                 \
+  double sscale = 1.0 / scaling_factor, sw = st->d->lane_weight[4];            \
+  double u0, u1, u2, u3, u4, z;                                                \
+  size_t i;                                                                    \
+  int k, l;                                                                    \
+  for (l = 0; l < 5; ++l) {                                                    \
+    s[l] = st->d->v[st->d->lane_ci[l]];                                        \
+    for (k = 1; k < 5 && l < 4; ++k) t[k][l] = s[l][k];                        \
+  }                                                                            \
+  v1 = _mm256_loadu_pd(t[1]); v2 = _mm256_loadu_pd(t[2]);                      \
+  v3 = _mm256_loadu_pd(t[3]); v4 = _mm256_loadu_pd(t[4]);                      \
+  u1 = s[4][1]; u2 = s[4][2]; u3 = s[4][3]; u4 = s[4][4];                      \
+  for (i = 0; i < frames; ++i) {                                               \
+    __m256d x = _mm256_set_pd((double) in3[i * stride],                        \
+                              (double) in2[i * stride],                        \
+                              (double) in1[i * stride],                        \
+                              (double) in0[i * stride]);                       \
+    __m128d lo, hi, sum;                                                       \
+    v0 = _mm256_sub_pd(_mm256_sub_pd(_mm256_sub_pd(_mm256_sub_pd(              \
+             _mm256_mul_pd(x, scale), _mm256_mul_pd(a1, v1)),                  \
+             _mm256_mul_pd(a2, v2)), _mm256_mul_pd(a3, v3)),                   \
+             _mm256_mul_pd(a4, v4));                                           \
+    u0 = (double) in4[i * stride] * sscale                                     \
+         - sa1 * u1 - sa2 * u2 - sa3 * u3 - sa4 * u4;                          \
+    y = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_add_pd(               \
+            _mm256_mul_pd(b0, v0), _mm256_mul_pd(b1, v1)),                     \
+            _mm256_mul_pd(b2, v2)), _mm256_mul_pd(b3, v3)),                    \
+            _mm256_mul_pd(b4, v4));                                            \
+    z = sb0 * u0 + sb1 * u1 + sb2 * u2 + sb3 * u3 + sb4 * u4;                  \
+    e = _mm256_mul_pd(w, _mm256_mul_pd(y, y));                                 \
+    lo = _mm256_castpd256_pd128(e);                                            \
+    hi = _mm256_extractf128_pd(e, 1);                                          \
+    sum = _mm_add_sd(_mm_load_sd(energy + i), lo);                             \
+    sum = _mm_add_sd(sum, _mm_unpackhi_pd(lo, lo));                            \
+    sum = _mm_add_sd(sum, hi);                                                 \
+    sum = _mm_add_sd(sum, _mm_unpackhi_pd(hi, hi));                            \
+    energy[i] = _mm_cvtsd_f64(sum) + sw * (z * z);                             \
+    v4 = v3; v3 = v2; v2 = v1; v1 = v0;                                        \
+    u4 = u3; u3 = u2; u2 = u1; u1 = u0;                                        \
+  }                                                                            \
+  _mm256_storeu_pd(t[1], v1); _mm256_storeu_pd(t[2], v2);                      \
+  _mm256_storeu_pd(t[3], v3); _mm256_storeu_pd(t[4], v4);                      \
+  for (l = 0; l < 4; ++l) {                                                    \
+    for (k = 1; k < 5; ++k) s[l][k] = t[k][l];                                 \
+    s[l][0] = s[l][1];                                                         \
+  }                                                                            \
+  s[4][0] = s[4][1] = u1; s[4][2] = u2; s[4][3] = u3; s[4][4] = u4;            \
+}
+EBUR128_FILTER_STEREO(short)
+EBUR128_FILTER_STEREO(int)
+EBUR128_FILTER_STEREO(float)
+EBUR128_FILTER_STEREO(double)
+EBUR128_FILTER_SURROUND(short)
+EBUR128_FILTER_SURROUND(int)
+EBUR128_FILTER_SURROUND(float)
+EBUR128_FILTER_SURROUND(double)
+
+/* Filters as many channels as possible with the vector kernels, returns 0 if
+ * the scalar loop has to be used instead. */
+#define EBUR128_FILTER_SIMD(type)                                              \
+static int ebur128_filter_simd_##type(ebur128_state* st, const type* src,      \
+                                      const type* const* planes,               \
+                                      size_t offset, size_t frames,            \
+                                      double scaling_factor) {                 \
+  size_t stride = planes ? 1 : st->channels;                                   \
+  const type* lane_src[5];                                                     \
+  double* energy = st->d->audio_data + st->d->audio_data_index;                \
+  const double* lane_weight = st->d->lane_weight;                              \
+  const int* ci = st->d->lane_ci;                                              \
+  size_t lanes = st->d->lanes, pos, n;                                         \
+  if (st->d->simd == EBUR128_SIMD_NONE || lanes < 2) return 0;                 \
+  for (pos = 0; pos < lanes; ++pos) {                                          \
+    lane_src[pos] = EBUR128_SOURCE(st, src, planes, offset,                    \
+                                   st->d->lane_channel[pos]);                  \
+  }                                                                            \
+  if (st->d->kernel == EBUR128_KERNEL_STEREO) {                                \
+    ebur128_filter_stereo_##type(st, lane_src, stride, frames,                 \
+                                 scaling_factor);                              \
+    return 1;                                                                  \
+  } else if (st->d->kernel == EBUR128_KERNEL_SURROUND) {                       \
+    ebur128_filter_surround_##type(st, lane_src, stride, frames,               \
+                                   scaling_factor);                            \
+    return 1;                                                                  \
+  }                                                                            \
+  for (pos = 0; pos < lanes; pos += n) {                                       \
+    n = lanes - pos;                                                           \
+    if (n > 4 && st->d->simd >= EBUR128_SIMD_AVX512) {                         \
+      ebur128_filter_lanes_##type##_avx512(st, lane_src + pos, stride, frames, \
+                                           energy, lane_weight + pos, ci + pos,\
+                                           n, scaling_factor);                 \
+    } else if (n > 2 && st->d->simd >= EBUR128_SIMD_AVX2) {                    \
+      if (n > 4) n = 4;                                                        \
+      ebur128_filter_lanes_##type##_avx2(st, lane_src + pos, stride, frames,   \
+                                         energy, lane_weight + pos, ci + pos,  \
+                                         n, scaling_factor);                   \
+    } else {                                                                   \
+      if (n > 2) n = 2;                                                        \
+      ebur128_filter_lanes_##type##_sse2(st, lane_src + pos, stride, frames,   \
+                                         energy, lane_weight + pos, ci + pos,  \
+                                         n, scaling_factor);                   \
+    }                                                                          \
+  }                                                                            \
+  return 1;                                                                    \
+}
+
+#define EBUR128_FILTER_SIMD_SINGLE(type)                                       \
+static int ebur128_filter_simd_single_##type(ebur128_state* st,                \
+                                             const type* src,                  \
+                                             const type* const* planes,        \
+                                             size_t offset, size_t frames,     \
+                                             double scaling_factor) {          \
+  size_t stride = planes ? 1 : st->channels;                                   \
+  const type* lane_src[5];                                                     \
+  double* energy = st->d->audio_data + st->d->audio_data_index;                \
+  const double* lane_weight = st->d->lane_weight;                              \
+  const int* ci = st->d->lane_ci;                                              \
+  size_t lanes = st->d->lanes, pos;                                            \
+  if (st->d->simd == EBUR128_SIMD_NONE || lanes == 0) return 0;                \
+  for (pos = 0; pos < lanes; ++pos) {                                          \
+    lane_src[pos] = EBUR128_SOURCE(st, src, planes, offset,                    \
+                                   st->d->lane_channel[pos]);                  \
+  }                                                                            \
+  if (lanes > 4 && st->d->simd >= EBUR128_SIMD_AVX2) {                         \
+    ebur128_filter_single_lanes_##type##_avx2(st, lane_src, stride, frames,    \
+                                              energy, lane_weight, ci, lanes,  \
+                                              (float) (1.0 / scaling_factor)); \
+  } else {                                                                     \
+    for (pos = 0; pos < lanes; pos += 4) {                                     \
+      ebur128_filter_single_lanes_##type##_sse2(st, lane_src + pos, stride,    \
+                                                frames, energy,                \
+                                                lane_weight + pos, ci + pos,   \
+                                                lanes - pos > 4 ? 4            \
+                                                                : lanes - pos, \
+                                                (float) (1.0 /                 \
+                                                         scaling_factor));     \
+    }                                                                          \
+  }                                                                            \
+  return 1;                                                                    \
+}
+#else
+#define EBUR128_FILTER_SIMD_SINGLE(type)                                       \
+static int ebur128_filter_simd_single_##type(ebur128_state* st,                \
+                                             const type* src,                  \
+                                             const type* const* planes,        \
+                                             size_t offset, size_t frames,     \
+                                             double scaling_factor) {          \
+  (void) st; (void) src; (void) planes; (void) offset; (void) frames;          \
+  (void) scaling_factor;                                                       \
+  return 0;                                                                    \
+}
+#define EBUR128_FILTER_SIMD(type)                                              \
+static int ebur128_filter_simd_##type(ebur128_state* st, const type* src,      \
+                                      const type* const* planes,               \
+                                      size_t offset, size_t frames,            \
+                                      double scaling_factor) {                 \
+  (void) st; (void) src; (void) planes; (void) offset; (void) frames;          \
+  (void) scaling_factor;                                                       \
+  return 0;                                                                    \
+}
+#endif
+EBUR128_FILTER_SIMD(short)
+EBUR128_FILTER_SIMD(int)
+EBUR128_FILTER_SIMD(float)
+EBUR128_FILTER_SIMD(double)
+EBUR128_FILTER_SIMD_SINGLE(short)
+EBUR128_FILTER_SIMD_SINGLE(int)
+EBUR128_FILTER_SIMD_SINGLE(float)
+EBUR128_FILTER_SIMD_SINGLE(double)
+
+/* Maximum absolute sample value per channel, without branches on the
+ * samples. NaN is ignored. The AVX2 kernels sweep interleaved input a vector
+ * at a time: with one accumulator per vector of a group of as many vectors as
+ * there are channels, each accumulator lane always sees the same channel. */
+#define EBUR128_MAX_ABS_SCALAR(type)                                           \
+static void ebur128_max_abs_scalar_##type(const type* src, size_t channels,    \
+                                          size_t frames, double* max) {        \
+  size_t i, c;                                                                 \
+  for (i = 0; i < frames; ++i) {                                               \
+    for (c = 0; c < channels; ++c) {                                           \
+      double a = fabs((double) src[i * channels + c]);                         \
+      max[c] = a > max[c] ? a : max[c];                                        \
+    }                                                                          \
+  }                                                                            \
+}
+EBUR128_MAX_ABS_SCALAR(short)
+EBUR128_MAX_ABS_SCALAR(int)
+EBUR128_MAX_ABS_SCALAR(float)
+EBUR128_MAX_ABS_SCALAR(double)
+
+#define EBUR128_MAX_ABS_CHANNELS 8
+
+#ifdef EBUR128_X86_SIMD
+#define EBUR128_ABS_PS(x) _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x)
+#define EBUR128_ABS_PD(x) _mm256_andnot_pd(_mm256_set1_pd(-0.0), x)
+#define EBUR128_LOAD_SI256(p) _mm256_loadu_si256((const __m256i*) (p))
+#define EBUR128_STORE_SI256(p, x) _mm256_storeu_si256((__m256i*) (p), x)
+#define EBUR128_MAX_ABS_AVX2(type, lane_type, width, vt, zero, load, store,   \
+                             abs, max)                                         \
+__attribute__((target("avx2")))                                                \
+static void ebur128_max_abs_avx2_##type(const type* src, size_t channels,      \
+                                        size_t frames, double* peak) {         \
+  vt acc[EBUR128_MAX_ABS_CHANNELS];                                            \
+  lane_type lanes[width];                                                      \
+  size_t groups = frames / width;                                              \
+  size_t i, j, l;                                                              \
+  for (j = 0; j < channels; ++j) acc[j] = zero();                              \
+  for (i = 0; i < groups; ++i) {                                               \
+    for (j = 0; j < channels; ++j) {                                           \
+      acc[j] = max(abs(load(src + (i * channels + j) * width)), acc[j]);       \
+    }                                                                          \
+  }                                                                            \
+  for (j = 0; j < channels; ++j) {                                             \
+    store(lanes, acc[j]);                                                      \
+    for (l = 0; l < width; ++l) {                                              \
+      double a = (double) lanes[l];                                            \
+      size_t c = (j * width + l) % channels;                                   \
+      peak[c] = a > peak[c] ? a : peak[c];                                     \
+    }                                                                          \
+  }                                                                            \
+  ebur128_max_abs_scalar_##type(src + groups * width * channels, channels,     \
+                                frames - groups * width, peak);                \
+}
+EBUR128_MAX_ABS_AVX2(short, unsigned short, 16, __m256i, _mm256_setzero_si256,
+                     EBUR128_LOAD_SI256, EBUR128_STORE_SI256,
+                     _mm256_abs_epi16, _mm256_max_epu16)
+EBUR128_MAX_ABS_AVX2(int, unsigned int, 8, __m256i, _mm256_setzero_si256,
+                     EBUR128_LOAD_SI256, EBUR128_STORE_SI256,
+                     _mm256_abs_epi32, _mm256_max_epu32)
+EBUR128_MAX_ABS_AVX2(float, float, 8, __m256, _mm256_setzero_ps,
+                     _mm256_loadu_ps, _mm256_storeu_ps,
+                     EBUR128_ABS_PS, _mm256_max_ps)
+EBUR128_MAX_ABS_AVX2(double, double, 4, __m256d, _mm256_setzero_pd,
+                     _mm256_loadu_pd, _mm256_storeu_pd,
+                     EBUR128_ABS_PD, _mm256_max_pd)
+#define EBUR128_MAX_ABS(type)                                                  \
+static void ebur128_max_abs_##type(ebur128_state* st, const type* src,         \
+                                   size_t channels, size_t frames,             \
+                                   double* max) {                              \
+  if (st->d->simd >= EBUR128_SIMD_AVX2) {                                      \
+    ebur128_max_abs_avx2_##type(src, channels, frames, max);                   \
+  } else {                                                                     \
+    ebur128_max_abs_scalar_##type(src, channels, frames, max);                 \
+  }                                                                            \
+}
+#else
+#define EBUR128_MAX_ABS(type)                                                  \
+static void ebur128_max_abs_##type(ebur128_state* st, const type* src,         \
+                                   size_t channels, size_t frames,             \
+                                   double* max) {                              \
+  (void) st;                                                                   \
+  ebur128_max_abs_scalar_##type(src, channels, frames, max);                   \
+}
+#endif
+EBUR128_MAX_ABS(short)
+EBUR128_MAX_ABS(int)
+EBUR128_MAX_ABS(float)
+EBUR128_MAX_ABS(double)
+
+/* Updates the sample peaks, at most EBUR128_MAX_ABS_CHANNELS interleaved
+ * channels are measured in one sweep. */
+#define EBUR128_SAMPLE_PEAK(type)                                              \
+static void ebur128_sample_peak_##type(ebur128_state* st, const type* src,     \
+                                       const type* const* planes,              \
+                                       size_t offset, size_t frames,           \
+                                       double scaling_factor) {                \
+  double max[EBUR128_MAX_ABS_CHANNELS];                                        \
+  size_t channels = planes || st->channels > EBUR128_MAX_ABS_CHANNELS          \
+                  ? 1 : st->channels;                                          \
+  size_t c, k;                                                                 \
+  for (c = 0; c < st->channels; c += channels) {                               \
+    const type* in = EBUR128_SOURCE(st, src, planes, offset, c);               \
+    size_t stride = planes ? 1 : st->channels;                                 \
+    for (k = 0; k < channels; ++k) max[k] = 0.0;                               \
+    if (stride == channels) {                                                  \
+      ebur128_max_abs_##type(st, in, channels, frames, max);                   \
+    } else {                                                                   \
+      size_t i;                                                                \
       for (i = 0; i < frames; ++i) {                                           \
-        st->d->resampler_buffer_input[i * st->channels + c] =                  \
-                      (float) (src[i * st->channels + c] / scaling_factor);    \
+        double a = fabs((double) in[i * stride]);                              \
+        max[0] = a > max[0] ? a : max[0];                                      \
+      }                                                                        \
+    }                                                                          \
+    for (k = 0; k < channels; ++k) {                                           \
+      max[k] /= scaling_factor;                                                \
+      if (max[k] > st->d->sample_peak[c + k]) {                                \
+        st->d->sample_peak[c + k] = max[k];                                    \
       }                                                                        \
     }                                                                          \
-    ebur128_check_true_peak(st, frames);                                       \
   }                                                                            \
+}
+EBUR128_SAMPLE_PEAK(short)
+EBUR128_SAMPLE_PEAK(int)
+EBUR128_SAMPLE_PEAK(float)
+EBUR128_SAMPLE_PEAK(double)
+
+/* Adds the energy of frames just filtered to the sums of their 100ms. */
+static void ebur128_add_partial_energy(ebur128_state* st, size_t frames) {
+  size_t i = st->d->audio_data_index;
+  size_t end = i + frames;
+  while (i < end) {
+    size_t k = i / st->d->samples_in_100ms;
+    size_t next = (k + 1) * st->d->samples_in_100ms;
+    double sum;
+    if (next > end) next = end;
+    sum = i % st->d->samples_in_100ms ? st->d->partial_energy[k] : 0.0;
+    for (; i < next; ++i) {
+      sum += st->d->audio_data[i];
+    }
+    st->d->partial_energy[k] = sum;
+  }
+}
+
+/* Largest absolute value of the interpolated samples between buf[0] and
+ * buf[frames + EBUR128_TP_TAPS - 1]. The vectorized version interpolates
+ * several frames at once, with the same operations in the same order. */
+static float ebur128_true_peak_fir_scalar(ebur128_state* st, const float* buf,
+                                          size_t frames) {
+  float peak = 0.0f, acc;
+  size_t i, p, k;
+  for (i = 0; i < frames; ++i) {
+    for (p = 0; p < st->d->oversample_factor; ++p) {
+      acc = 0.0f;
+      for (k = 0; k < EBUR128_TP_TAPS; ++k) {
+        acc += st->d->tp_coef[p][k] * buf[i + k];
+      }
+      acc = fabsf(acc);
+      peak = acc > peak ? acc : peak;
+    }
+  }
+  return peak;
+}
+
+#ifdef EBUR128_X86_SIMD
+/* Interpolates 16 frames per iteration, keeping every phase of both halves
+ * in its own accumulator so the additions do not wait for each other.
+ * frames must be a multiple of 16. */
+#define EBUR128_TRUE_PEAK_FIR_AVX2(factor)                                     \
+__attribute__((target("avx2")))                                                \
+static float ebur128_true_peak_fir_avx2_##factor(ebur128_state* st,            \
+                                                 const float* buf,             \
+                                                 size_t frames) {              \
+  __m256 sign = _mm256_set1_ps(-0.0f), peak = _mm256_setzero_ps();             \
+  __m256 acc[2][factor], coef, lo, hi;                                         \
+  float out[8], result = 0.0f;                                                 \
+  size_t i, p, k;                                                              \
+  for (i = 0; i < frames; i += 16) {                                           \
+    for (p = 0; p < factor; ++p) {                                             \
+      acc[0][p] = _mm256_setzero_ps();                                         \
+      acc[1][p] = _mm256_setzero_ps();                                         \
+    }                                                                          \
+    for (k = 0; k < EBUR128_TP_TAPS; ++k) {                                    \
+      lo = _mm256_loadu_ps(buf + i + k);                                       \
+      hi = _mm256_loadu_ps(buf + i + k + 8);                                   \
+      for (p = 0; p < factor; ++p) {                                           \
+        coef = _mm256_set1_ps(st->d->tp_coef[p][k]);                           \
+        acc[0][p] = _mm256_add_ps(acc[0][p], _mm256_mul_ps(coef, lo));         \
+        acc[1][p] = _mm256_add_ps(acc[1][p], _mm256_mul_ps(coef, hi));         \
+      }                                                                        \
+    }                                                                          \
+    for (p = 0; p < factor; ++p) {                                             \
+      peak = _mm256_max_ps(peak, _mm256_andnot_ps(sign, acc[0][p]));           \
+      peak = _mm256_max_ps(peak, _mm256_andnot_ps(sign, acc[1][p]));           \
+    }                                                                          \
+  }                                                                            \
+  _mm256_storeu_ps(out, peak);                                                 \
+  for (k = 0; k < 8; ++k) {                                                    \
+    result = out[k] > result ? out[k] : result;                                \
+  }                                                                            \
+  return result;                                                               \
+}
+EBUR128_TRUE_PEAK_FIR_AVX2(2)
+EBUR128_TRUE_PEAK_FIR_AVX2(4)
+#endif
+
+static float ebur128_true_peak_fir(ebur128_state* st, const float* buf,
+                                   size_t frames) {
+  float peak = 0.0f, tail;
+  size_t done = 0;
+#ifdef EBUR128_X86_SIMD
+  if (st->d->simd >= EBUR128_SIMD_AVX2) {
+    done = frames / 16 * 16;
+    peak = st->d->oversample_factor == 4
+               ? ebur128_true_peak_fir_avx2_4(st, buf, done)
+               : ebur128_true_peak_fir_avx2_2(st, buf, done);
+  }
+#endif
+  tail = ebur128_true_peak_fir_scalar(st, buf + done, frames - done);
+  return tail > peak ? tail : peak;
+}
+
+#define EBUR128_TRUE_PEAK(type)                                                \
+static void ebur128_true_peak_##type(ebur128_state* st, const type* src,       \
+                                     const type* const* planes, size_t offset, \
+                                     size_t frames, double scaling_factor) {   \
+  size_t stride = planes ? 1 : st->channels;                                   \
+  double scale = 1.0 / scaling_factor; /* exact, it is a power of two */       \
+  float* buf = st->d->tp_buffer;                                               \
+  float* history;                                                              \
+  float peak;                                                                  \
+  size_t i, c;                                                                 \
+  for (c = 0; c < st->channels; ++c) {                                         \
+    const type* in = EBUR128_SOURCE(st, src, planes, offset, c);               \
+    history = st->d->tp_history + c * (EBUR128_TP_TAPS - 1);                   \
+    memcpy(buf, history, (EBUR128_TP_TAPS - 1) * sizeof(float));               \
+    for (i = 0; i < frames; ++i) {                                             \
+      buf[EBUR128_TP_TAPS - 1 + i] = (float) (in[i * stride] * scale);        \
+    }                                                                          \
+    peak = ebur128_true_peak_fir(st, buf, frames);                             \
+    if (peak > st->d->true_peak[c]) {                                          \
+      st->d->true_peak[c] = peak;                                              \
+    }                                                                          \
+    memcpy(history, buf + frames, (EBUR128_TP_TAPS - 1) * sizeof(float));      \
+  }                                                                            \
+}
+EBUR128_TRUE_PEAK(short)
+EBUR128_TRUE_PEAK(int)
+EBUR128_TRUE_PEAK(float)
+EBUR128_TRUE_PEAK(double)
+
+/* Single precision filter for one channel at a time, see
+ * EBUR128_FILTER_LANES_SINGLE. */
+#define EBUR128_FILTER_SINGLE(type)                                            \
+static void ebur128_filter_single_##type(ebur128_state* st, const type* src,   \
+                                         const type* const* planes,            \
+                                         size_t offset, size_t frames,         \
+                                         double scaling_factor) {              \
+  size_t stride = planes ? 1 : st->channels;                                   \
+  double* energy = st->d->audio_data + st->d->audio_data_index;                \
+  float scale = (float) (1.0 / scaling_factor);                                \
+  const float* pb = st->d->sb[0];                                              \
+  const float* pa = st->d->sa[0];                                              \
+  const float* rb = st->d->sb[1];                                              \
+  const float* ra = st->d->sa[1];                                              \
+  size_t i, c;                                                                 \
+  int k;                                                                       \
   for (c = 0; c < st->channels; ++c) {                                         \
+    const type* in = EBUR128_SOURCE(st, src, planes, offset, c);               \
+    float weight = (float) ebur128_channel_weight(st->d->channel_map[c]);      \
+    float* z;                                                                  \
     int ci = st->d->channel_map[c] - 1;                                        \
     if (ci < 0) continue;                                                      \
     else if (ci > 4) ci = 0; /* dual mono */                                   \
+    z = &st->d->sv[ci][0][0];                                                  \
     for (i = 0; i < frames; ++i) {                                             \
-      st->d->v[ci][0] = (double) (src[i * st->channels + c] / scaling_factor)  \
-                   - st->d->a[1] * st->d->v[ci][1]                             \
-                   - st->d->a[2] * st->d->v[ci][2]                             \
-                   - st->d->a[3] * st->d->v[ci][3]                             \
-                   - st->d->a[4] * st->d->v[ci][4];                            \
-      audio_data[i * st->channels + c] =                                       \
-                     st->d->b[0] * st->d->v[ci][0]                             \
-                   + st->d->b[1] * st->d->v[ci][1]                             \
-                   + st->d->b[2] * st->d->v[ci][2]                             \
-                   + st->d->b[3] * st->d->v[ci][3]                             \
-                   + st->d->b[4] * st->d->v[ci][4];                            \
-      st->d->v[ci][4] = st->d->v[ci][3];                                       \
-      st->d->v[ci][3] = st->d->v[ci][2];                                       \
-      st->d->v[ci][2] = st->d->v[ci][1];                                       \
-      st->d->v[ci][1] = st->d->v[ci][0];                                       \
+      float x = (float) in[i * stride] * scale;                                \
+      float y0 = pb[0] * x + z[0];                                             \
+      float y;                                                                 \
+      z[0] = (pb[1] * x + z[1]) - pa[1] * y0;                                  \
+      z[1] = pb[2] * x - pa[2] * y0;                                           \
+      y = rb[0] * y0 + z[2];                                                   \
+      z[2] = (rb[1] * y0 + z[3]) - ra[1] * y;                                  \
+      z[3] = rb[2] * y0 - ra[2] * y;                                           \
+      energy[i] += (double) (weight * (y * y));                                \
+    }                                                                          \
+    FLUSH_MANUALLY_SINGLE                                                      \
+  }                                                                            \
+  (void) k;                                                                    \
+}
+EBUR128_FILTER_SINGLE(short)
+EBUR128_FILTER_SINGLE(int)
+EBUR128_FILTER_SINGLE(float)
+EBUR128_FILTER_SINGLE(double)
+
+/* Sample and true peak of the input, before decimation if there is any */
+#define EBUR128_PEAK(type)                                                     \
+static void ebur128_peak_##type(ebur128_state* st, const type* src,            \
+                                const type* const* planes, size_t offset,      \
+                                size_t frames, double scaling_factor) {        \
+  if ((st->mode & EBUR128_MODE_SAMPLE_PEAK) == EBUR128_MODE_SAMPLE_PEAK) {     \
+    ebur128_sample_peak_##type(st, src, planes, offset, frames,                \
+                               scaling_factor);                                \
+  }                                                                            \
+  if (st->d->oversample_factor > 1) {                                          \
+    ebur128_true_peak_##type(st, src, planes, offset, frames, scaling_factor); \
+  }                                                                            \
+}
+EBUR128_PEAK(short)
+EBUR128_PEAK(int)
+EBUR128_PEAK(float)
+EBUR128_PEAK(double)
+
+/* Mono has a single filter state, so it is kept in locals together with the
+ * coefficients. The stores to audio_data could alias st->d otherwise, which
+ * makes the generic loop reload all of them for every frame. */
+#define EBUR128_FILTER_MONO(type)                                              \
+static void ebur128_filter_mono_##type(ebur128_state* st, const type* in,      \
+                                       size_t frames, double scaling_factor) { \
+  double* energy = st->d->audio_data + st->d->audio_data_index;                \
+  int ci = st->d->lane_ci[0];                                                  \
+  double weight = st->d->lane_weight[0];                                       \
+  double a1 = st->d->a[1], a2 = st->d->a[2], a3 = st->d->a[3];                 \
+  double a4 = st->d->a[4];                                                     \
+  double b0 = st->d->b[0], b1 = st->d->b[1], b2 = st->d->b[2];                 \
+  double b3 = st->d->b[3], b4 = st->d->b[4];                                   \
+  double v0, v1 = st->d->v[ci][1], v2 = st->d->v[ci][2];                       \
+  double v3 = st->d->v[ci][3], v4 = st->d->v[ci][4];                           \
+  size_t i;                                                                    \
+  for (i = 0; i < frames; ++i) {                                               \
+    double y;                                                                  \
+    v0 = (double) (in[i] / scaling_factor)                                     \
+         - a1 * v1 - a2 * v2 - a3 * v3 - a4 * v4;                              \
+    y = b0 * v0 + b1 * v1 + b2 * v2 + b3 * v3 + b4 * v4;                       \
+    energy[i] += weight * (y * y);                                             \
+    v4 = v3; v3 = v2; v2 = v1; v1 = v0;                                        \
+  }                                                                            \
+  st->d->v[ci][0] = v1;                                                        \
+  st->d->v[ci][1] = v1;                                                        \
+  st->d->v[ci][2] = v2;                                                        \
+  st->d->v[ci][3] = v3;                                                        \
+  st->d->v[ci][4] = v4;                                                        \
+  FLUSH_MANUALLY                                                               \
+}
+EBUR128_FILTER_MONO(short)
+EBUR128_FILTER_MONO(int)
+EBUR128_FILTER_MONO(float)
+EBUR128_FILTER_MONO(double)
+
+#define EBUR128_FILTER(type, min_scale, max_scale)                             \
+static void ebur128_filter_##type(ebur128_state* st, const type* src,          \
+                                  const type* const* planes, size_t offset,    \
+                                  size_t frames) {                             \
+  static double scaling_factor = -((double) min_scale) > (double) max_scale ?  \
+                                 -((double) min_scale) : (double) max_scale;   \
+  size_t stride = planes ? 1 : st->channels;                                   \
+  double* audio_data = st->d->audio_data + st->d->audio_data_index;            \
+  size_t i, c;                                                                 \
+                                                                               \
+  TURN_ON_FTZ                                                                  \
+                                                                               \
+  if (st->d->decimation == 1) {                                                \
+    ebur128_peak_##type(st, src, planes, offset, frames, scaling_factor);      \
+  }                                                                            \
+  for (i = 0; i < frames; ++i) {                                               \
+    audio_data[i] = 0.0;                                                       \
+  }                                                                            \
+  if (st->mode & EBUR128_MODE_SINGLE_PRECISION) {                              \
+    if (!ebur128_filter_simd_single_##type(st, src, planes, offset, frames,    \
+                                           scaling_factor)) {                  \
+      ebur128_filter_single_##type(st, src, planes, offset, frames,            \
+                                   scaling_factor);                            \
+    }                                                                          \
+  } else if (st->d->kernel == EBUR128_KERNEL_MONO) {                           \
+    ebur128_filter_mono_##type(st, EBUR128_SOURCE(st, src, planes, offset, 0), \
+                               frames, scaling_factor);                        \
+  } else if (!ebur128_filter_simd_##type(st, src, planes, offset, frames,      \
+                                         scaling_factor)) {                    \
+    for (c = 0; c < st->channels; ++c) {                                       \
+      const type* in = EBUR128_SOURCE(st, src, planes, offset, c);             \
+      double weight = ebur128_channel_weight(st->d->channel_map[c]);           \
+      int ci = st->d->channel_map[c] - 1;                                      \
+      if (ci < 0) continue;                                                    \
+      else if (ci > 4) ci = 0; /* dual mono */                                 \
+      for (i = 0; i < frames; ++i) {                                           \
+        double y;                                                              \
+        st->d->v[ci][0] = (double) (in[i * stride] / scaling_factor)           \
+                     - st->d->a[1] * st->d->v[ci][1]                           \
+                     - st->d->a[2] * st->d->v[ci][2]                           \
+                     - st->d->a[3] * st->d->v[ci][3]                           \
+                     - st->d->a[4] * st->d->v[ci][4];                          \
+        y =            st->d->b[0] * st->d->v[ci][0]                           \
+                     + st->d->b[1] * st->d->v[ci][1]                           \
+                     + st->d->b[2] * st->d->v[ci][2]                           \
+                     + st->d->b[3] * st->d->v[ci][3]                           \
+                     + st->d->b[4] * st->d->v[ci][4];                          \
+        audio_data[i] += weight * (y * y);                                     \
+        st->d->v[ci][4] = st->d->v[ci][3];                                     \
+        st->d->v[ci][3] = st->d->v[ci][2];                                     \
+        st->d->v[ci][2] = st->d->v[ci][1];                                     \
+        st->d->v[ci][1] = st->d->v[ci][0];                                     \
+      }                                                                        \
+      FLUSH_MANUALLY                                                           \
     }                                                                          \
-    FLUSH_MANUALLY                                                             \
   }                                                                            \
+  ebur128_add_partial_energy(st, frames);                                      \
   TURN_OFF_FTZ                                                                 \
 }
 EBUR128_FILTER(short, SHRT_MIN, SHRT_MAX)
@@ -483,62 +1586,224 @@ EBUR128_FILTER(int, INT_MIN, INT_MAX)
 EBUR128_FILTER(float, -1.0f, 1.0f)
 EBUR128_FILTER(double, -1.0, 1.0)
 
+/* Appends the frames to the stage, alternating between the even and odd
+ * arrays of each channel. */
+#define EBUR128_HALFBAND_PUSH(type)                                            \
+static void ebur128_halfband_push_##type(ebur128_state* st,                    \
+                                         struct ebur128_halfband* hb,          \
+                                         const type* src,                      \
+                                         const type* const* planes,            \
+                                         size_t offset, size_t frames,         \
+                                         float scale) {                        \
+  size_t stride = planes ? 1 : st->channels;                                   \
+  int odd_first = hb->evens != hb->odds;                                       \
+  size_t c, i;                                                                 \
+  for (c = 0; c < st->channels; ++c) {                                         \
+    const type* x = EBUR128_SOURCE(st, src, planes, offset, c);                \
+    float* even = hb->buffer + 2 * c * hb->capacity + hb->evens;               \
+    float* odd = hb->buffer + (2 * c + 1) * hb->capacity + hb->odds;           \
+    i = 0;                                                                     \
+    if (odd_first && frames > 0) {                                             \
+      *odd++ = (float) x[0] * scale;                                           \
+      i = 1;                                                                   \
+    }                                                                          \
+    for (; i + 1 < frames; i += 2) {                                           \
+      *even++ = (float) x[i * stride] * scale;                                 \
+      *odd++ = (float) x[(i + 1) * stride] * scale;                            \
+    }                                                                          \
+    if (i < frames) {                                                          \
+      *even = (float) x[i * stride] * scale;                                   \
+    }                                                                          \
+  }                                                                            \
+  if (odd_first) {                                                             \
+    hb->odds += (frames + 1) / 2;                                              \
+    hb->evens += frames / 2;                                                   \
+  } else {                                                                     \
+    hb->evens += (frames + 1) / 2;                                             \
+    hb->odds += frames / 2;                                                    \
+  }                                                                            \
+}
+EBUR128_HALFBAND_PUSH(short)
+EBUR128_HALFBAND_PUSH(int)
+EBUR128_HALFBAND_PUSH(float)
+EBUR128_HALFBAND_PUSH(double)
+
+/* Output k is centered on odd[k + pairs - 1], with the pairs around it in
+ * even[k] to even[k + 2 * pairs - 1]. */
+static void ebur128_halfband_scalar(const struct ebur128_halfband* hb,
+                                    const float* even, const float* odd,
+                                    float* out, size_t frames) {
+  size_t k, j;
+  for (k = 0; k < frames; ++k) {
+    float y = hb->center * odd[k + hb->pairs - 1];
+    for (j = 0; j < hb->pairs; ++j) {
+      y += hb->h[j] * (even[k + hb->pairs - 1 - j] + even[k + hb->pairs + j]);
+    }
+    out[k] = y;
+  }
+}
+
+#ifdef EBUR128_X86_SIMD
+/* 32 outputs at a time in four accumulators, which hides the latency of the
+ * additions, with the same operations in the same order as the scalar loop.
+ * frames must be a multiple of 32. */
+__attribute__((target("avx2")))
+static void ebur128_halfband_avx2(const struct ebur128_halfband* hb,
+                                  const float* even, const float* odd,
+                                  float* out, size_t frames) {
+  __m256 center = _mm256_set1_ps(hb->center);
+  size_t k, j;
+  for (k = 0; k < frames; k += 32) {
+    const float* x = odd + k + hb->pairs - 1;
+    __m256 y0 = _mm256_mul_ps(center, _mm256_loadu_ps(x));
+    __m256 y1 = _mm256_mul_ps(center, _mm256_loadu_ps(x + 8));
+    __m256 y2 = _mm256_mul_ps(center, _mm256_loadu_ps(x + 16));
+    __m256 y3 = _mm256_mul_ps(center, _mm256_loadu_ps(x + 24));
+    for (j = 0; j < hb->pairs; ++j) {
+      __m256 h = _mm256_set1_ps(hb->h[j]);
+      const float* lo = even + k + hb->pairs - 1 - j;
+      const float* hi = even + k + hb->pairs + j;
+      y0 = _mm256_add_ps(y0, _mm256_mul_ps(h, _mm256_add_ps(
+               _mm256_loadu_ps(lo), _mm256_loadu_ps(hi))));
+      y1 = _mm256_add_ps(y1, _mm256_mul_ps(h, _mm256_add_ps(
+               _mm256_loadu_ps(lo + 8), _mm256_loadu_ps(hi + 8))));
+      y2 = _mm256_add_ps(y2, _mm256_mul_ps(h, _mm256_add_ps(
+               _mm256_loadu_ps(lo + 16), _mm256_loadu_ps(hi + 16))));
+      y3 = _mm256_add_ps(y3, _mm256_mul_ps(h, _mm256_add_ps(
+               _mm256_loadu_ps(lo + 24), _mm256_loadu_ps(hi + 24))));
+    }
+    _mm256_storeu_ps(out + k, y0);
+    _mm256_storeu_ps(out + k + 8, y1);
+    _mm256_storeu_ps(out + k + 16, y2);
+    _mm256_storeu_ps(out + k + 24, y3);
+  }
+}
+#endif
+
+/* Filters everything a stage has and writes one output per pair of input
+ * samples to out, one array of stride samples per channel. Returns how many
+ * were written, the samples the next outputs need are kept. */
+static size_t ebur128_halfband(ebur128_state* st, struct ebur128_halfband* hb,
+                               float* out, size_t stride) {
+  size_t taps = 2 * hb->pairs;
+  size_t frames = hb->evens >= taps ? hb->evens - taps + 1 : 0;
+  size_t c, done;
+  for (c = 0; c < st->channels; ++c) {
+    float* even = hb->buffer + 2 * c * hb->capacity;
+    float* odd = even + hb->capacity;
+    done = 0;
+#ifdef EBUR128_X86_SIMD
+    if (st->d->simd >= EBUR128_SIMD_AVX2) {
+      done = frames / 32 * 32;
+      ebur128_halfband_avx2(hb, even, odd, out + c * stride, done);
+    }
+#endif
+    ebur128_halfband_scalar(hb, even + done, odd + done,
+                            out + c * stride + done, frames - done);
+    memmove(even, even + frames, (hb->evens - frames) * sizeof(float));
+    memmove(odd, odd + frames, (hb->odds - frames) * sizeof(float));
+  }
+  hb->evens -= frames;
+  hb->odds -= frames;
+  return frames;
+}
+
+static int ebur128_add_frames_any_float(ebur128_state* st, const float* src,
+                                        const float* const* planes,
+                                        size_t frames);
+/* Takes the peaks of the input, then decimates it and measures the loudness
+ * of the result. */
+#define EBUR128_DECIMATE(type, min_scale, max_scale)                           \
+static int ebur128_decimate_##type(ebur128_state* st, const type* src,         \
+                                   const type* const* planes, size_t frames) { \
+  static double scaling_factor = -((double) min_scale) > (double) max_scale ?  \
+                                 -((double) min_scale) : (double) max_scale;   \
+  /* as much as the true peak buffer holds */                                  \
+  size_t size = st->d->samples_in_100ms * 4;                                   \
+  size_t offset = 0, s, n;                                                     \
+  while (frames > 0) {                                                         \
+    size_t piece = frames < size ? frames : size;                              \
+    ebur128_peak_##type(st, src, planes, offset, piece, scaling_factor);       \
+    ebur128_halfband_push_##type(st, &st->d->halfband[0], src, planes, offset, \
+                                 piece, (float) (1.0 / scaling_factor));       \
+    n = ebur128_halfband(st, &st->d->halfband[0], st->d->decimated, size / 2); \
+    for (s = 1; s < st->d->halfbands; ++s) {                                   \
+      ebur128_halfband_push_float(st, &st->d->halfband[s], NULL,               \
+                                  st->d->decimated_planes, 0, n, 1.0f);        \
+      n = ebur128_halfband(st, &st->d->halfband[s], st->d->decimated,          \
+                           size / 2);                                          \
+    }                                                                          \
+    if (ebur128_add_frames_any_float(st, NULL, st->d->decimated_planes, n)) {  \
+      return EBUR128_ERROR_NOMEM;                                              \
+    }                                                                          \
+    offset += piece;                                                           \
+    frames -= piece;                                                           \
+  }                                                                            \
+  return EBUR128_SUCCESS;                                                      \
+}
+EBUR128_DECIMATE(short, SHRT_MIN, SHRT_MAX)
+EBUR128_DECIMATE(int, INT_MIN, INT_MAX)
+EBUR128_DECIMATE(float, -1.0f, 1.0f)
+EBUR128_DECIMATE(double, -1.0, 1.0)
+
 static double ebur128_energy_to_loudness(double energy) {
   return 10 * (log(energy) / log(10.0)) - 0.691;
 }
 
 static size_t find_histogram_index(double energy) {
-  size_t index_min = 0;
-  size_t index_max = 1000;
-  size_t index_mid;
-
-  do {
-    index_mid = (index_min + index_max) / 2;
-    if (energy >= histogram_energy_boundaries[index_mid]) {
-      index_min = index_mid;
-    } else {
-      index_max = index_mid;
-    }
-  } while (index_max - index_min != 1);
+  /* The bins are 0.1 LU wide, so the index follows from log2 of the energy.
+   * It is estimated from the exponent bits and a quadratic in the mantissa,
+   * which is less than a bin off, and the boundaries decide the rest. */
+  uint64_t bits;
+  double mantissa, log2_energy;
+  size_t index;
+
+  if (!(energy >= histogram_energy_boundaries[1])) {
+    return 0;
+  } else if (energy >= histogram_energy_boundaries[999]) {
+    return 999;
+  }
+  memcpy(&bits, &energy, sizeof(bits));
+  log2_energy = (double) ((int) (bits >> 52) - 1023);
+  bits = (bits & UINT64_C(0x000fffffffffffff)) | UINT64_C(0x3ff0000000000000);
+  memcpy(&mantissa, &bits, sizeof(mantissa));
+  log2_energy += (-0.34484843 * mantissa + 2.02466578) * mantissa - 1.67487759;
+
+  index = (size_t) (30.10299956639812 * log2_energy + 693.09);
+  if (energy < histogram_energy_boundaries[index]) {
+    --index;
+  } else if (index < 999 && energy >= histogram_energy_boundaries[index + 1]) {
+    ++index;
+  }
 
-  return index_min;
+  return index;
 }
 
 static int ebur128_calc_gating_block(ebur128_state* st, size_t frames_per_block,
                                      double* optional_output) {
-  size_t i, c;
+  size_t i;
   double sum = 0.0;
-  double channel_sum;
-  for (c = 0; c < st->channels; ++c) {
-    if (st->d->channel_map[c] == EBUR128_UNUSED) continue;
-    channel_sum = 0.0;
-    if (st->d->audio_data_index < frames_per_block * st->channels) {
-      for (i = 0; i < st->d->audio_data_index / st->channels; ++i) {
-        channel_sum += st->d->audio_data[i * st->channels + c] *
-                       st->d->audio_data[i * st->channels + c];
-      }
-      for (i = st->d->audio_data_frames -
-              (frames_per_block -
-               st->d->audio_data_index / st->channels);
-           i < st->d->audio_data_frames; ++i) {
-        channel_sum += st->d->audio_data[i * st->channels + c] *
-                       st->d->audio_data[i * st->channels + c];
-      }
-    } else {
-      for (i = st->d->audio_data_index / st->channels - frames_per_block;
-           i < st->d->audio_data_index / st->channels;
-           ++i) {
-        channel_sum += st->d->audio_data[i * st->channels + c] *
-                       st->d->audio_data[i * st->channels + c];
-      }
+  if (st->d->audio_data_index % st->d->samples_in_100ms == 0) {
+    /* the block is made of whole 100ms, add up their sums */
+    size_t n = st->d->audio_data_frames / st->d->samples_in_100ms;
+    size_t end = st->d->audio_data_index / st->d->samples_in_100ms + n;
+    for (i = end - frames_per_block / st->d->samples_in_100ms; i < end; ++i) {
+      sum += st->d->partial_energy[i % n];
+    }
+  } else if (st->d->audio_data_index < frames_per_block) {
+    for (i = 0; i < st->d->audio_data_index; ++i) {
+      sum += st->d->audio_data[i];
+    }
+    for (i = st->d->audio_data_frames -
+            (frames_per_block - st->d->audio_data_index);
+         i < st->d->audio_data_frames; ++i) {
+      sum += st->d->audio_data[i];
     }
-    if (st->d->channel_map[c] == EBUR128_LEFT_SURROUND ||
-        st->d->channel_map[c] == EBUR128_RIGHT_SURROUND) {
-      channel_sum *= 1.41;
-    } else if (st->d->channel_map[c] == EBUR128_DUAL_MONO) {
-      channel_sum *= 2.0;
+  } else {
+    for (i = st->d->audio_data_index - frames_per_block;
+         i < st->d->audio_data_index; ++i) {
+      sum += st->d->audio_data[i];
     }
-    sum += channel_sum;
   }
   sum /= (double) frames_per_block;
   if (optional_output) {
@@ -548,11 +1813,7 @@ static int ebur128_calc_gating_block(ebur128_state* st, size_t frames_per_block,
     if (st->d->use_histogram) {
       ++st->d->block_energy_histogram[find_histogram_index(sum)];
     } else {
-      struct ebur128_dq_entry* block;
-      block = (struct ebur128_dq_entry*) malloc(sizeof(struct ebur128_dq_entry));
-      if (!block) return EBUR128_ERROR_NOMEM;
-      block->z = sum;
-      SLIST_INSERT_HEAD(&st->d->block_list, block, entries);
+      return ebur128_dq_push(&st->d->block_list, &st->d->spare_chunks, sum);
     }
     return EBUR128_SUCCESS;
   } else {
@@ -572,6 +1833,7 @@ int ebur128_set_channel(ebur128_state* st,
     return 1;
   }
   st->d->channel_map[channel_number] = value;
+  ebur128_init_kernel(st);
   return 0;
 }
 
@@ -594,11 +1856,6 @@ int ebur128_change_parameters(ebur128_state* st,
     free(st->d->true_peak);   st->d->true_peak = NULL;
     st->channels = channels;
 
-#ifdef USE_SPEEX_RESAMPLER
-    ebur128_destroy_resampler(st);
-    ebur128_init_resampler(st);
-#endif
-
     errcode = ebur128_init_channel_map(st);
     CHECK_ERROR(errcode, EBUR128_ERROR_NOMEM, exit)
 
@@ -613,8 +1870,16 @@ int ebur128_change_parameters(ebur128_state* st,
   }
   if (samplerate != st->samplerate) {
     st->samplerate = samplerate;
+    st->d->decimation = ebur128_decimation(st->mode, samplerate);
+    st->d->samples_in_100ms = (st->samplerate / st->d->decimation + 5) / 10;
     ebur128_init_filter(st);
   }
+  ebur128_destroy_true_peak(st);
+  errcode = ebur128_init_true_peak(st);
+  CHECK_ERROR(errcode, EBUR128_ERROR_NOMEM, exit)
+  ebur128_destroy_decimator(st);
+  errcode = ebur128_init_decimator(st);
+  CHECK_ERROR(errcode, EBUR128_ERROR_NOMEM, exit)
   if ((st->mode & EBUR128_MODE_S) == EBUR128_MODE_S) {
     st->d->audio_data_frames = st->d->samples_in_100ms * 30;
   } else if ((st->mode & EBUR128_MODE_M) == EBUR128_MODE_M) {
@@ -623,9 +1888,12 @@ int ebur128_change_parameters(ebur128_state* st,
     return 1;
   }
   st->d->audio_data = (double*) malloc(st->d->audio_data_frames *
-                                       st->channels *
+                                       sizeof(double) +
+                                       st->d->audio_data_frames /
+                                       st->d->samples_in_100ms *
                                        sizeof(double));
   CHECK_ERROR(!st->d->audio_data, EBUR128_ERROR_NOMEM, exit)
+  st->d->partial_energy = st->d->audio_data + st->d->audio_data_frames;
 
   /* the first block needs 400ms of audio data */
   st->d->needed_frames = st->d->samples_in_100ms * 4;
@@ -640,18 +1908,44 @@ exit:
   return 1;
 }
 
+int ebur128_reset(ebur128_state* st,
+                  unsigned int channels,
+                  unsigned long samplerate) {
+  if (channels != st->channels || samplerate != st->samplerate) {
+    if (ebur128_change_parameters(st, channels, samplerate)) {
+      return EBUR128_ERROR_NOMEM;
+    }
+  }
+  ebur128_reset_filter(st);
+  ebur128_default_channel_map(st);
+  ebur128_discard_measurements(st);
+  if (st->d->tp_history) {
+    memset(st->d->tp_history, 0,
+           st->channels * (EBUR128_TP_TAPS - 1) * sizeof(float));
+  }
+  ebur128_reset_decimator(st);
+  /* the first block needs 400ms of audio data */
+  st->d->needed_frames = st->d->samples_in_100ms * 4;
+  /* start at the beginning of the buffer */
+  st->d->audio_data_index = 0;
+  /* reset short term frame counter */
+  st->d->short_term_frame_counter = 0;
+  return EBUR128_SUCCESS;
+}
+
 
 static int ebur128_energy_shortterm(ebur128_state* st, double* out);
 #define EBUR128_ADD_FRAMES(type)                                               \
-int ebur128_add_frames_##type(ebur128_state* st,                               \
-                              const type* src, size_t frames) {                \
+static int ebur128_add_frames_any_##type(ebur128_state* st, const type* src,   \
+                                         const type* const* planes,            \
+                                         size_t frames) {                      \
   size_t src_index = 0;                                                        \
   while (frames > 0) {                                                         \
     if (frames >= st->d->needed_frames) {                                      \
-      ebur128_filter_##type(st, src + src_index, st->d->needed_frames);        \
-      src_index += st->d->needed_frames * st->channels;                        \
+      ebur128_filter_##type(st, src, planes, src_index, st->d->needed_frames); \
+      src_index += st->d->needed_frames;                                       \
       frames -= st->d->needed_frames;                                          \
-      st->d->audio_data_index += st->d->needed_frames * st->channels;          \
+      st->d->audio_data_index += st->d->needed_frames;                         \
       /* calculate the new gating block */                                     \
       if ((st->mode & EBUR128_MODE_I) == EBUR128_MODE_I) {                     \
         if (ebur128_calc_gating_block(st, st->d->samples_in_100ms * 4, NULL)) {\
@@ -661,19 +1955,15 @@ int ebur128_add_frames_##type(ebur128_state* st,                               \
       if ((st->mode & EBUR128_MODE_LRA) == EBUR128_MODE_LRA) {                 \
         st->d->short_term_frame_counter += st->d->needed_frames;               \
         if (st->d->short_term_frame_counter == st->d->samples_in_100ms * 30) { \
-          struct ebur128_dq_entry* block;                                      \
           double st_energy;                                                    \
           ebur128_energy_shortterm(st, &st_energy);                            \
           if (st_energy >= histogram_energy_boundaries[0]) {                   \
             if (st->d->use_histogram) {                                        \
               ++st->d->short_term_block_energy_histogram[                      \
                                               find_histogram_index(st_energy)];\
-            } else {                                                           \
-              block = (struct ebur128_dq_entry*)                               \
-                      malloc(sizeof(struct ebur128_dq_entry));                 \
-              if (!block) return EBUR128_ERROR_NOMEM;                          \
-              block->z = st_energy;                                            \
-              SLIST_INSERT_HEAD(&st->d->short_term_block_list, block, entries);\
+            } else if (ebur128_dq_push(&st->d->short_term_block_list,          \
+                                       &st->d->spare_chunks, st_energy)) {     \
+              return EBUR128_ERROR_NOMEM;                                      \
             }                                                                  \
           }                                                                    \
           st->d->short_term_frame_counter = st->d->samples_in_100ms * 20;      \
@@ -682,12 +1972,12 @@ int ebur128_add_frames_##type(ebur128_state* st,                               \
       /* 100ms are needed for all blocks besides the first one */              \
       st->d->needed_frames = st->d->samples_in_100ms;                          \
       /* reset audio_data_index when buffer full */                            \
-      if (st->d->audio_data_index == st->d->audio_data_frames * st->channels) {\
+      if (st->d->audio_data_index == st->d->audio_data_frames) {               \
         st->d->audio_data_index = 0;                                           \
       }                                                                        \
     } else {                                                                   \
-      ebur128_filter_##type(st, src + src_index, frames);                      \
-      st->d->audio_data_index += frames * st->channels;                        \
+      ebur128_filter_##type(st, src, planes, src_index, frames);               \
+      st->d->audio_data_index += frames;                                       \
       if ((st->mode & EBUR128_MODE_LRA) == EBUR128_MODE_LRA) {                 \
         st->d->short_term_frame_counter += frames;                             \
       }                                                                        \
@@ -696,6 +1986,20 @@ int ebur128_add_frames_##type(ebur128_state* st,                               \
     }                                                                          \
   }                                                                            \
   return EBUR128_SUCCESS;                                                      \
+}                                                                              \
+int ebur128_add_frames_##type(ebur128_state* st,                               \
+                              const type* src, size_t frames) {                \
+  if (st->d->decimation > 1) {                                                 \
+    return ebur128_decimate_##type(st, src, NULL, frames);                     \
+  }                                                                            \
+  return ebur128_add_frames_any_##type(st, src, NULL, frames);                 \
+}                                                                              \
+int ebur128_add_frames_planar_##type(ebur128_state* st,                        \
+                                     const type* const* src, size_t frames) {  \
+  if (st->d->decimation > 1) {                                                 \
+    return ebur128_decimate_##type(st, NULL, src, frames);                     \
+  }                                                                            \
+  return ebur128_add_frames_any_##type(st, NULL, src, frames);                 \
 }
 EBUR128_ADD_FRAMES(short)
 EBUR128_ADD_FRAMES(int)
@@ -704,7 +2008,7 @@ EBUR128_ADD_FRAMES(double)
 
 static int ebur128_gated_loudness(ebur128_state** sts, size_t size,
                                   double* out) {
-  struct ebur128_dq_entry* it;
+  struct ebur128_dq_chunk* it;
   double relative_threshold = 0.0;
   double gated_loudness = 0.0;
   size_t above_thresh_counter = 0;
@@ -726,8 +2030,10 @@ static int ebur128_gated_loudness(ebur128_state** sts, size_t size,
       }
     } else {
       SLIST_FOREACH(it, &sts[i]->d->block_list, entries) {
-        ++above_thresh_counter;
-        relative_threshold += it->z;
+        for (j = it->used; j > 0; --j) {
+          relative_threshold += it->z[j - 1];
+        }
+        above_thresh_counter += it->used;
       }
     }
   }
@@ -756,9 +2062,11 @@ static int ebur128_gated_loudness(ebur128_state** sts, size_t size,
       }
     } else {
       SLIST_FOREACH(it, &sts[i]->d->block_list, entries) {
-        if (it->z >= relative_threshold) {
-          ++above_thresh_counter;
-          gated_loudness += it->z;
+        for (j = it->used; j > 0; --j) {
+          if (it->z[j - 1] >= relative_threshold) {
+            ++above_thresh_counter;
+            gated_loudness += it->z[j - 1];
+          }
         }
       }
     }
@@ -781,6 +2089,77 @@ int ebur128_loudness_global_multiple(ebur128_state** sts, size_t size,
   return ebur128_gated_loudness(sts, size, out);
 }
 
+int ebur128_add_to_summary(ebur128_state* st, ebur128_summary* summary) {
+  struct ebur128_dq_chunk* it;
+  size_t i, j;
+
+  if ((st->mode & EBUR128_MODE_I) != EBUR128_MODE_I) {
+    return EBUR128_ERROR_INVALID_MODE;
+  }
+  if (st->d->use_histogram) {
+    for (j = 0; j < 1000; ++j) {
+      summary->blocks[j] += st->d->block_energy_histogram[j];
+      summary->energy[j] += st->d->block_energy_histogram[j] *
+                            histogram_energies[j];
+    }
+  } else {
+    SLIST_FOREACH(it, &st->d->block_list, entries) {
+      for (i = 0; i < it->used; ++i) {
+        j = find_histogram_index(it->z[i]);
+        ++summary->blocks[j];
+        summary->energy[j] += it->z[i];
+      }
+    }
+  }
+  return EBUR128_SUCCESS;
+}
+
+int ebur128_loudness_summary(const ebur128_summary* summary, double* out) {
+  double relative_threshold = 0.0;
+  double gated_loudness = 0.0;
+  double above_thresh_counter = 0.0;
+  double fraction;
+  size_t j, start_index;
+
+  for (j = 0; j < 1000; ++j) {
+    relative_threshold += summary->energy[j];
+    above_thresh_counter += (double) summary->blocks[j];
+  }
+  if (above_thresh_counter == 0.0) {
+    *out = -HUGE_VAL;
+    return EBUR128_SUCCESS;
+  }
+  relative_threshold /= above_thresh_counter;
+  relative_threshold *= relative_gate_factor;
+  above_thresh_counter = 0.0;
+  if (relative_threshold < histogram_energy_boundaries[0]) {
+    start_index = 0;
+  } else {
+    /* The blocks of the bin the threshold falls into are not known any
+     * more, take the part of the bin above the threshold assuming they are
+     * spread evenly over it. */
+    start_index = find_histogram_index(relative_threshold);
+    fraction = 100.0 * log10(histogram_energy_boundaries[start_index + 1] /
+                             relative_threshold);
+    if (fraction < 0.0) fraction = 0.0;
+    if (fraction > 1.0) fraction = 1.0;
+    gated_loudness += fraction * summary->energy[start_index];
+    above_thresh_counter += fraction * (double) summary->blocks[start_index];
+    ++start_index;
+  }
+  for (j = start_index; j < 1000; ++j) {
+    gated_loudness += summary->energy[j];
+    above_thresh_counter += (double) summary->blocks[j];
+  }
+  if (above_thresh_counter == 0.0) {
+    *out = -HUGE_VAL;
+    return EBUR128_SUCCESS;
+  }
+  gated_loudness /= above_thresh_counter;
+  *out = ebur128_energy_to_loudness(gated_loudness);
+  return EBUR128_SUCCESS;
+}
+
 static int ebur128_energy_in_interval(ebur128_state* st,
                                       size_t interval_frames,
                                       double* out) {
@@ -831,8 +2210,8 @@ static int ebur128_double_cmp(const void *p1, const void *p2) {
 /* EBU - TECH 3342 */
 int ebur128_loudness_range_multiple(ebur128_state** sts, size_t size,
                                     double* out) {
-  size_t i, j;
-  struct ebur128_dq_entry* it;
+  size_t i, j, k;
+  struct ebur128_dq_chunk* it;
   double* stl_vector;
   size_t stl_size;
   double* stl_relgated;
@@ -917,7 +2296,7 @@ int ebur128_loudness_range_multiple(ebur128_state** sts, size_t size,
     for (i = 0; i < size; ++i) {
       if (!sts[i]) continue;
       SLIST_FOREACH(it, &sts[i]->d->short_term_block_list, entries) {
-        ++stl_size;
+        stl_size += it->used;
       }
     }
     if (!stl_size) {
@@ -931,8 +2310,10 @@ int ebur128_loudness_range_multiple(ebur128_state** sts, size_t size,
     for (j = 0, i = 0; i < size; ++i) {
       if (!sts[i]) continue;
       SLIST_FOREACH(it, &sts[i]->d->short_term_block_list, entries) {
-        stl_vector[j] = it->z;
-        ++j;
+        for (k = it->used; k > 0; --k) {
+          stl_vector[j] = it->z[k - 1];
+          ++j;
+        }
       }
     }
     qsort(stl_vector, stl_size, sizeof(double), ebur128_double_cmp);
@@ -980,7 +2361,6 @@ int ebur128_sample_peak(ebur128_state* st,
   return EBUR128_SUCCESS;
 }
 
-#ifdef USE_SPEEX_RESAMPLER
 int ebur128_true_peak(ebur128_state* st,
                       unsigned int channel_number,
                       double* out) {
@@ -994,4 +2374,3 @@ int ebur128_true_peak(ebur128_state* st,
        : st->d->sample_peak[channel_number];
   return EBUR128_SUCCESS;
 }
-#endif
@@ -61,7 +61,16 @@ enum mode {
   EBUR128_MODE_TRUE_PEAK   = (1 << 5) | EBUR128_MODE_M
                                       | EBUR128_MODE_SAMPLE_PEAK,
   /** uses histogram algorithm to calculate loudness */
-  EBUR128_MODE_HISTOGRAM   = (1 << 6)
+  EBUR128_MODE_HISTOGRAM   = (1 << 6),
+  /** filters in single precision, which is faster but adds an error in the
+   *  order of 0.001 LU to the results */
+  EBUR128_MODE_SINGLE_PRECISION = (1 << 7),
+  /** measures loudness of input at 88.2 kHz and above after decimating it to
+   *  44.1 or 48 kHz, peaks are still taken from the input. Content above
+   *  20 kHz is left out, so band-limited material reads within about
+   *  0.05 LU of a full-rate measurement while ultrasonic noise no longer
+   *  counts. Meant for quick previews. */
+  EBUR128_MODE_DECIMATE    = (1 << 8)
 };
 
 /** forward declaration of ebur128_state_internal */
@@ -78,6 +87,16 @@ typedef struct {
   struct ebur128_state_internal* d;   /**< Internal state. */
 } ebur128_state;
 
+/** \brief Fixed-size summary of the gating blocks of one or more measurements.
+ *
+ *  Gating blocks are sorted into 1000 bins, 0.1 LU wide and starting at
+ *  -70 LUFS. Initialize with zeroes before adding states to it.
+ */
+typedef struct {
+  unsigned long blocks[1000];         /**< Number of blocks in each bin. */
+  double energy[1000];                /**< Summed energy of those blocks. */
+} ebur128_summary;
+
 /** \brief Get library version number. Do not pass null pointers here.
  *
  *  @param major major version number of library
@@ -142,6 +161,44 @@ int ebur128_change_parameters(ebur128_state* st,
                               unsigned int channels,
                               unsigned long samplerate);
 
+/** \brief Reset library state for a new measurement.
+ *
+ *  Leaves the state as ebur128_init() would have returned it with the given
+ *  channels and samplerate and the mode of the state: all measurements and
+ *  the filter state are discarded and the channel map is set to the default.
+ *  If channels and samplerate have not changed, no memory is allocated or
+ *  freed, so states can be reused for many measurements.
+ *
+ *  @param st library state.
+ *  @param channels number of channels.
+ *  @param samplerate sample rate.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM on memory allocation error. The state will be
+ *      invalid and must be destroyed.
+ */
+int ebur128_reset(ebur128_state* st,
+                  unsigned int channels,
+                  unsigned long samplerate);
+
+/** \brief Discard all blocks and peaks measured so far.
+ *
+ *  The filter state and the audio of the current blocks are kept, so this can
+ *  be used to warm up the filter on audio preceding the part of a programme
+ *  that should be measured. Blocks are measured every 100ms once the first
+ *  400ms have been added, so the warm-up should be a multiple of 100ms and at
+ *  least 400ms long for the following blocks to line up with the ones of a
+ *  measurement started at the beginning of the programme. The short-term
+ *  blocks of the loudness range start over: the first one ends 3s after the
+ *  call, so it covers no discarded audio, and the following ones line up with
+ *  those of the whole programme if the call falls on a whole second of it.
+ *
+ *  @param st library state.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ */
+int ebur128_discard_measurements(ebur128_state* st);
+
 /** \brief Add frames to be processed.
  *
  *  @param st library state.
@@ -167,6 +224,31 @@ int ebur128_add_frames_double(ebur128_state* st,
                              const double* src,
                              size_t frames);
 
+/** \brief Add frames to be processed, with one array per channel.
+ *
+ *  @param st library state.
+ *  @param src array of st->channels pointers to the samples of each channel.
+ *  @param frames number of frames. Not number of samples!
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM on memory allocation error.
+ */
+int ebur128_add_frames_planar_short(ebur128_state* st,
+                                    const short* const* src,
+                                    size_t frames);
+/** \brief See \ref ebur128_add_frames_planar_short */
+int ebur128_add_frames_planar_int(ebur128_state* st,
+                                    const int* const* src,
+                                    size_t frames);
+/** \brief See \ref ebur128_add_frames_planar_short */
+int ebur128_add_frames_planar_float(ebur128_state* st,
+                                    const float* const* src,
+                                    size_t frames);
+/** \brief See \ref ebur128_add_frames_planar_short */
+int ebur128_add_frames_planar_double(ebur128_state* st,
+                                    const double* const* src,
+                                    size_t frames);
+
 /** \brief Get global integrated loudness in LUFS.
  *
  *  @param st library state.
@@ -190,6 +272,33 @@ int ebur128_loudness_global(ebur128_state* st, double* out);
 int ebur128_loudness_global_multiple(ebur128_state** sts,
                                      size_t size,
                                      double* out);
+/** \brief Add the gating blocks of a state to a summary.
+ *
+ *  The state can be destroyed afterwards, the summary keeps what is needed
+ *  to calculate the integrated loudness of everything added to it.
+ *
+ *  @param st library state.
+ *  @param summary summary to add the gating blocks to.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_INVALID_MODE if mode "EBUR128_MODE_I" has not been set.
+ */
+int ebur128_add_to_summary(ebur128_state* st, ebur128_summary* summary);
+/** \brief Get integrated loudness in LUFS of the states added to a summary.
+ *
+ *  Only the blocks in the 0.1 LU bin of the relative threshold are gated by
+ *  their bin instead of one by one. With n blocks in that bin and N blocks
+ *  above it, the result differs from ebur128_loudness_global_multiple() over
+ *  the same states by at most 10 * log10(1 + n / N) LU, which is a few
+ *  hundredths of a LU once an album holds a few minutes of audio.
+ *
+ *  @param summary summary of one or more states.
+ *  @param out integrated loudness in LUFS. -HUGE_VAL if result is negative
+ *             infinity.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ */
+int ebur128_loudness_summary(const ebur128_summary* summary, double* out);
 
 /** \brief Get momentary loudness (last 400ms) in LUFS.
  *
@@ -264,9 +373,11 @@ int ebur128_sample_peak(ebur128_state* st,
  *  try to compare resulting values across different versions of the library,
  *  as the algorithm may change.
  *
- *  The current implementation uses the Speex resampler with quality level 8 to
- *  calculate true peak. Will oversample 4x for sample rates < 96000 Hz, 2x for
- *  sample rates < 192000 Hz and leave the signal unchanged for 192000 Hz.
+ *  The current implementation interpolates with a 12 taps per phase
+ *  polyphase FIR filter (a Hann windowed sinc). Will oversample 4x for sample
+ *  rates < 96000 Hz, 2x for sample rates < 192000 Hz and leave the signal
+ *  unchanged for 192000 Hz. This roughly doubles the time spent in
+ *  ebur128_add_frames_* compared to measuring the sample peak only.
  *
  *  @param st library state
  *  @param channel_number channel to analyse
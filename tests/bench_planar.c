@@ -0,0 +1,107 @@
+/* Times ten minutes of 48 kHz float input with modes I, LRA and sample peak,
+ * fed as interleaved frames, as planes, and as interleaved frames split into
+ * planes block by block the way the scanner does. */
+
+#include "ebur128.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define SAMPLERATE 48000
+#define SECONDS 600
+#define LOOP_FRAMES (10 * SAMPLERATE)
+#define BLOCK 4096
+#define RUNS 3
+
+enum { INTERLEAVED, PLANAR, SPLIT, NUM_LAYOUTS };
+
+static const char* names[NUM_LAYOUTS] = {
+  "interleaved", "planar", "split per block"
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static double run(unsigned channels, int layout, const float* interleaved,
+                  float* const* planes, float* const* split) {
+  const float* block_planes[8];
+  ebur128_state* st;
+  size_t done, pos, n, i;
+  unsigned c;
+  double start;
+
+  st = ebur128_init(channels, SAMPLERATE, EBUR128_MODE_I | EBUR128_MODE_LRA |
+                                              EBUR128_MODE_SAMPLE_PEAK);
+  if (!st) return -1.0;
+  start = now();
+  for (done = 0; done < (size_t) SECONDS * SAMPLERATE; done += LOOP_FRAMES) {
+    for (pos = 0; pos < LOOP_FRAMES; pos += n) {
+      n = LOOP_FRAMES - pos < BLOCK ? LOOP_FRAMES - pos : BLOCK;
+      if (layout == INTERLEAVED) {
+        ebur128_add_frames_float(st, interleaved + pos * channels, n);
+        continue;
+      }
+      for (c = 0; c < channels; ++c) {
+        if (layout == PLANAR) {
+          block_planes[c] = planes[c] + pos;
+        } else {
+          for (i = 0; i < n; ++i) {
+            split[c][i] = interleaved[(pos + i) * channels + c];
+          }
+          block_planes[c] = split[c];
+        }
+      }
+      ebur128_add_frames_planar_float(st, block_planes, n);
+    }
+  }
+  start = now() - start;
+  ebur128_destroy(&st);
+  return start;
+}
+
+int main(void) {
+  static const unsigned layouts[] = {2, 6};
+  float* planes[8];
+  float* split[8];
+  unsigned long seed = 1;
+  size_t i;
+  unsigned c, k;
+  int layout, r;
+
+  printf("%d s of %d Hz float, modes I, LRA and sample peak, best of %d\n",
+         SECONDS, SAMPLERATE, RUNS);
+  for (k = 0; k < 2; ++k) {
+    unsigned channels = layouts[k];
+    float* interleaved = malloc(LOOP_FRAMES * channels * sizeof(float));
+
+    if (!interleaved) return 1;
+    for (c = 0; c < channels; ++c) {
+      planes[c] = malloc(LOOP_FRAMES * sizeof(float));
+      split[c] = malloc(BLOCK * sizeof(float));
+      if (!planes[c] || !split[c]) return 1;
+    }
+    for (i = 0; i < LOOP_FRAMES * channels; ++i) {
+      seed = seed * 1103515245 + 12345;
+      interleaved[i] = (float) ((seed >> 16) % 2000) / 2000.0f - 0.5f;
+      planes[i % channels][i / channels] = interleaved[i];
+    }
+    for (layout = 0; layout < NUM_LAYOUTS; ++layout) {
+      double best = -1.0;
+      for (r = 0; r < RUNS; ++r) {
+        double t = run(channels, layout, interleaved, planes, split);
+        if (best < 0.0 || t < best) best = t;
+      }
+      printf("%u channels, %-16s %.3f s\n", channels, names[layout], best);
+    }
+    for (c = 0; c < channels; ++c) {
+      free(planes[c]);
+      free(split[c]);
+    }
+    free(interleaved);
+  }
+  return 0;
+}
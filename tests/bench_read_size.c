@@ -0,0 +1,433 @@
+/*
+    ReplayGain scanner benchmark: decoder read sizes
+
+    Drives rg_scan through a fake host whose decoder reads raw PCM files,
+    which stay in the page cache, so the time is that of the read calls, the
+    sample unpacking and the analysis. Each run scans five 30 s stereo
+    tracks, all reading the same file, on one worker, with
+    rgscan.read_frames set to each of the sizes below and to 0, which tunes
+    the size while scanning. The best of several runs is printed for 16-bit
+    44.1 kHz, 24-bit 96 kHz and float 48 kHz tracks. The benchmark fails if
+    a read size changes any gain or peak.
+*/
+
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <deadbeef/deadbeef.h>              // deadbeef SDK
+#include "ddb_misc_rg_scan.h"
+
+#define NUM_TRACKS 5
+#define TRACK_SECONDS 30
+#define RUNS 5
+
+DB_plugin_t* ddb_misc_replaygain_scan_load (DB_functions_t *api);
+
+struct test_format {
+    const char *name;
+    int bps;
+    int is_float;
+    int samplerate;
+    char path[PATH_MAX];                    // TRACK_SECONDS of interleaved stereo
+};
+
+static struct test_format formats[] = {
+    { "16-bit 44.1k", 16, 0, 44100 },
+    { "24-bit 96k", 24, 0, 96000 },
+    { "float 48k", 32, 1, 48000 },
+};
+
+static const int sizes[] = { 2000, 8192, 16384, 32768, 65536, 0 };
+
+#define NUM_FORMATS (int) (sizeof (formats) / sizeof (formats[0]))
+#define NUM_SIZES (int) (sizeof (sizes) / sizeof (sizes[0]))
+
+typedef struct {
+    DB_playItem_t item;
+    struct test_format *format;
+} test_item_t;
+
+typedef struct {
+    DB_fileinfo_t info;
+    int fd;
+    int samplesize;
+} test_fileinfo_t;
+
+static test_item_t items[NUM_TRACKS];
+static int conf_read_frames;
+
+/* --- host --- */
+
+struct test_thread {
+    void (*fn) (void *ctx);
+    void *ctx;
+};
+
+static void *test_thread_main (void *arg)
+{
+    struct test_thread t = *(struct test_thread *) arg;
+    free (arg);
+    t.fn (t.ctx);
+    return NULL;
+}
+
+static intptr_t test_thread_start (void (*fn) (void *ctx), void *ctx)
+{
+    struct test_thread *t = malloc (sizeof (struct test_thread));
+    pthread_t tid;
+    t->fn = fn;
+    t->ctx = ctx;
+    if (pthread_create (&tid, NULL, test_thread_main, t) != 0) {
+        free (t);
+        return 0;
+    }
+    return (intptr_t) tid;
+}
+
+static int test_thread_join (intptr_t tid)
+{
+    return pthread_join ((pthread_t) tid, NULL);
+}
+
+static uintptr_t test_mutex_create (void)
+{
+    pthread_mutex_t *m = malloc (sizeof (pthread_mutex_t));
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init (&attr);
+    pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init (m, &attr);
+    pthread_mutexattr_destroy (&attr);
+    return (uintptr_t) m;
+}
+
+static void test_mutex_free (uintptr_t m)
+{
+    pthread_mutex_destroy ((pthread_mutex_t *) m);
+    free ((void *) m);
+}
+
+static int test_mutex_lock (uintptr_t m)
+{
+    return pthread_mutex_lock ((pthread_mutex_t *) m);
+}
+
+static int test_mutex_unlock (uintptr_t m)
+{
+    return pthread_mutex_unlock ((pthread_mutex_t *) m);
+}
+
+static pthread_mutex_t pl_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+static void test_pl_lock (void)
+{
+    pthread_mutex_lock (&pl_mutex);
+}
+
+static void test_pl_unlock (void)
+{
+    pthread_mutex_unlock (&pl_mutex);
+}
+
+static const char *test_pl_find_meta (DB_playItem_t *it, const char *key)
+{
+    if (!strcmp (key, ":URI")) {
+        return ((test_item_t *) it)->format->path;
+    }
+    if (!strcmp (key, ":DECODER")) {
+        return "test_pcm";
+    }
+    return NULL;
+}
+
+static float test_pl_get_item_duration (DB_playItem_t *it)
+{
+    return TRACK_SECONDS;
+}
+
+static uint32_t test_pl_get_item_flags (DB_playItem_t *it)
+{
+    return 0;
+}
+
+static void test_pl_item_unref (DB_playItem_t *it)
+{
+}
+
+static int test_conf_get_int (const char *key, int def)
+{
+    if (!strcmp (key, "rgscan.read_frames")) {
+        return conf_read_frames;
+    }
+    return def;
+}
+
+static float test_conf_get_float (const char *key, float def)
+{
+    return def;
+}
+
+static void test_conf_get_str (const char *key, const char *def, char *buffer, int buffer_size)
+{
+    snprintf (buffer, buffer_size, "%s", def);
+}
+
+// every format here is analysed as decoded
+static int test_pcm_convert (const ddb_waveformat_t *inputfmt, const char *input, const ddb_waveformat_t *outputfmt, char *output, int inputsize)
+{
+    return 0;
+}
+
+/* --- decoder for the raw files written below --- */
+
+static DB_decoder_t test_pcm;
+
+static DB_fileinfo_t *test_pcm_open (uint32_t hints)
+{
+    test_fileinfo_t *info = calloc (1, sizeof (test_fileinfo_t));
+    info->info.plugin = &test_pcm;
+    info->fd = -1;
+    return &info->info;
+}
+
+static int test_pcm_init (DB_fileinfo_t *_info, DB_playItem_t *it)
+{
+    test_fileinfo_t *info = (test_fileinfo_t *) _info;
+    struct test_format *f = ((test_item_t *) it)->format;
+    info->fd = open (f->path, O_RDONLY);
+    if (info->fd < 0) {
+        return -1;
+    }
+    info->samplesize = 2 * (f->bps / 8);
+    _info->fmt.bps = f->bps;
+    _info->fmt.is_float = f->is_float;
+    _info->fmt.channels = 2;
+    _info->fmt.samplerate = f->samplerate;
+    _info->fmt.channelmask = 3;
+    return 0;
+}
+
+static void test_pcm_free (DB_fileinfo_t *_info)
+{
+    test_fileinfo_t *info = (test_fileinfo_t *) _info;
+    if (info->fd >= 0) {
+        close (info->fd);
+    }
+    free (info);
+}
+
+static int test_pcm_read (DB_fileinfo_t *_info, char *buffer, int nbytes)
+{
+    test_fileinfo_t *info = (test_fileinfo_t *) _info;
+    ssize_t size = read (info->fd, buffer, nbytes / info->samplesize * info->samplesize);
+    return size > 0 ? (int) size : 0;
+}
+
+static int test_pcm_seek_sample (DB_fileinfo_t *_info, int sample)
+{
+    test_fileinfo_t *info = (test_fileinfo_t *) _info;
+    if (lseek (info->fd, (off_t) sample * info->samplesize, SEEK_SET) < 0) {
+        return -1;
+    }
+    _info->readpos = (float) sample / _info->fmt.samplerate;
+    return 0;
+}
+
+static DB_decoder_t test_pcm = {
+    .plugin.type = DB_PLUGIN_DECODER,
+    .plugin.id = "test_pcm",
+    .open = test_pcm_open,
+    .init = test_pcm_init,
+    .free = test_pcm_free,
+    .read = test_pcm_read,
+    .seek_sample = test_pcm_seek_sample,
+};
+
+static DB_decoder_t *decoders[] = { &test_pcm, NULL };
+
+static DB_plugin_t *test_plug_get_for_id (const char *id)
+{
+    return !strcmp (id, "test_pcm") ? DB_PLUGIN (&test_pcm) : NULL;
+}
+
+static DB_decoder_t **test_plug_get_decoder_list (void)
+{
+    return decoders;
+}
+
+static DB_functions_t api = {
+    .thread_start = test_thread_start,
+    .thread_join = test_thread_join,
+    .mutex_create = test_mutex_create,
+    .mutex_create_nonrecursive = test_mutex_create,
+    .mutex_free = test_mutex_free,
+    .mutex_lock = test_mutex_lock,
+    .mutex_unlock = test_mutex_unlock,
+    .pl_lock = test_pl_lock,
+    .pl_unlock = test_pl_unlock,
+    .pl_find_meta = test_pl_find_meta,
+    .pl_find_meta_raw = test_pl_find_meta,
+    .pl_get_item_duration = test_pl_get_item_duration,
+    .pl_get_item_flags = test_pl_get_item_flags,
+    .pl_item_unref = test_pl_item_unref,
+    .plug_get_for_id = test_plug_get_for_id,
+    .plug_get_decoder_list = test_plug_get_decoder_list,
+    .pcm_convert = test_pcm_convert,
+    .conf_get_int = test_conf_get_int,
+    .conf_get_float = test_conf_get_float,
+    .conf_get_str = test_conf_get_str,
+};
+
+/* --- benchmark --- */
+
+// a few tones over noise, with the level changing every second for the gates
+static int write_track (struct test_format *f, const char *dir)
+{
+    int bytes = f->bps / 8;
+    int frames = TRACK_SECONDS * f->samplerate;
+    char *data = malloc ((size_t) frames * 2 * bytes);
+    uint32_t seed = 1;
+
+    if (!data) {
+        return -1;
+    }
+    for (int i = 0; i < frames; i++) {
+        double t = (double) i / f->samplerate;
+        double level = 0.05 + 0.2 * ((i / f->samplerate) % 4);
+        for (int ch = 0; ch < 2; ch++) {
+            seed = seed * 1664525 + 1013904223;
+            double s = level * (0.5 * sin (2 * M_PI * (220 + 110 * ch) * t)
+                                + 0.3 * sin (2 * M_PI * 3520 * t)
+                                + 0.2 * ((seed >> 8) / 8388608.0 - 1));
+            char *out = data + ((size_t) i * 2 + ch) * bytes;
+            if (f->is_float) {
+                float v = (float) s;
+                memcpy (out, &v, 4);
+            }
+            else {
+                int32_t v = (int32_t) lrint (s * ((1 << (f->bps - 1)) - 1));
+                for (int b = 0; b < bytes; b++) {
+                    out[b] = (char) ((uint32_t) v >> (8 * b));
+                }
+            }
+        }
+    }
+
+    snprintf (f->path, sizeof (f->path), "%s/%d-%d.raw", dir, f->bps, f->samplerate);
+    FILE *fp = fopen (f->path, "wb");
+    int written = fp && fwrite (data, (size_t) frames * 2 * bytes, 1, fp) == 1;
+    if (fp && fclose (fp) != 0) {
+        written = 0;
+    }
+    free (data);
+    return written ? 0 : -1;
+}
+
+static double now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the scanner reports on stdout after every scan, which would bury the table
+static double scan (rg_scan_t *rg, float *track_rg, float *track_pk)
+{
+    DB_playItem_t *scan_items[NUM_TRACKS];
+    float album_rg, album_pk, targetdb = 89;
+    int num_tracks = NUM_TRACKS, num_threads = 1, abort = 0;
+
+    for (int i = 0; i < NUM_TRACKS; i++) {
+        scan_items[i] = &items[i].item;
+    }
+    fflush (stdout);
+    int out = dup (STDOUT_FILENO);
+    int null = open ("/dev/null", O_WRONLY);
+    dup2 (null, STDOUT_FILENO);
+    close (null);
+
+    double start = now ();
+    rg->rg_scan (scan_items, &num_tracks, track_rg, track_pk, &album_rg, &album_pk, &targetdb, &num_threads, &abort);
+    double seconds = now () - start;
+
+    fflush (stdout);
+    dup2 (out, STDOUT_FILENO);
+    close (out);
+    return seconds;
+}
+
+int main (void)
+{
+    rg_scan_t *rg = (rg_scan_t *) ddb_misc_replaygain_scan_load (&api);
+    double best[NUM_SIZES][NUM_FORMATS];
+    int problems = 0;
+    char dir[] = "/tmp/rg_scan_bench_XXXXXX";
+
+    if (!mkdtemp (dir)) {
+        fprintf (stderr, "bench_read_size: could not create a directory\n");
+        return 1;
+    }
+    for (int f = 0; f < NUM_FORMATS; f++) {
+        float ref_rg[NUM_TRACKS], ref_pk[NUM_TRACKS];
+
+        if (write_track (&formats[f], dir) != 0) {
+            fprintf (stderr, "bench_read_size: could not write %s\n", formats[f].path);
+            problems++;
+            break;
+        }
+        for (int i = 0; i < NUM_TRACKS; i++) {
+            items[i].format = &formats[f];
+        }
+        for (int s = 0; s < NUM_SIZES; s++) {
+            conf_read_frames = sizes[s];
+            best[s][f] = HUGE_VAL;
+            for (int run = 0; run < RUNS; run++) {
+                float track_rg[NUM_TRACKS], track_pk[NUM_TRACKS];
+                double t = scan (rg, track_rg, track_pk);
+                if (t < best[s][f]) {
+                    best[s][f] = t;
+                }
+                if (s == 0 && run == 0) {
+                    memcpy (ref_rg, track_rg, sizeof (ref_rg));
+                    memcpy (ref_pk, track_pk, sizeof (ref_pk));
+                }
+                else if (memcmp (ref_rg, track_rg, sizeof (ref_rg)) || memcmp (ref_pk, track_pk, sizeof (ref_pk))) {
+                    fprintf (stdout, "bench_read_size: %s: results differ at %d frames\n", formats[f].name, sizes[s]);
+                    problems++;
+                }
+            }
+        }
+        unlink (formats[f].path);
+    }
+    rmdir (dir);
+    if (problems) {
+        return 1;
+    }
+
+    fprintf (stdout, "best of %d runs, %d x %d s stereo on one worker\n\n", RUNS, NUM_TRACKS, TRACK_SECONDS);
+    fprintf (stdout, "  frames  ");
+    for (int f = 0; f < NUM_FORMATS; f++) {
+        fprintf (stdout, "  %-12s", formats[f].name);
+    }
+    fprintf (stdout, "\n");
+    for (int s = 0; s < NUM_SIZES; s++) {
+        if (sizes[s]) {
+            fprintf (stdout, "  %-6d  ", sizes[s]);
+        }
+        else {
+            fprintf (stdout, "  tuned   ");
+        }
+        for (int f = 0; f < NUM_FORMATS; f++) {
+            fprintf (stdout, "  %.3f s     ", best[s][f]);
+        }
+        fprintf (stdout, "\n");
+    }
+    return 0;
+}
@@ -0,0 +1,238 @@
+/* Checks integrated loudness and loudness range against a plain reference
+ * that filters every frame and sums each gating and short-term block from
+ * scratch. Ten minutes of stereo audio give more gating blocks than one chunk
+ * of the block lists holds, and more short-term blocks than one chunk too. The
+ * audio is added in one call and in chunks of odd lengths. It is also added
+ * to a state that measured other audio before ebur128_reset, to one measured
+ * and reset with the same parameters, which reuses its chunks, and across
+ * ebur128_change_parameters. The static functions are reached by including
+ * ebur128.c. */
+
+#include "ebur128.c"
+
+#include <stdio.h>
+
+#define CHANNELS 2
+#define SAMPLERATE 8000
+#define SECONDS 600
+#define LIMIT 1e-9
+
+struct reference {
+  double* blocks;
+  size_t num_blocks;
+  double* short_term;
+  size_t num_short_term;
+};
+
+static unsigned long long rng = 88172645463325252ULL;
+
+static double uniform(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return (double) (rng >> 11) / 9007199254740992.0;
+}
+
+/* Noise whose level steps between -50 and -5 dBFS every 0.2 to 8 seconds,
+ * with silent stretches now and then. */
+static float* generate(size_t frames, unsigned channels,
+                       unsigned long samplerate) {
+  float* buf = malloc(frames * channels * sizeof(float));
+  size_t i, step = 0;
+  unsigned c;
+  double gain = 0.0;
+
+  if (!buf) return NULL;
+  for (i = 0; i < frames; ++i) {
+    if (step == 0) {
+      step = (size_t) ((0.2 + 7.8 * uniform()) * (double) samplerate);
+      gain = uniform() < 0.1 ? 0.0 : pow(10.0, (-50.0 + 45.0 * uniform())
+                                                  / 20.0);
+    }
+    --step;
+    for (c = 0; c < channels; ++c) {
+      buf[i * channels + c] = (float) (gain * (2.0 * uniform() - 1.0));
+    }
+  }
+  return buf;
+}
+
+/* Appends the blocks of the audio, measured from a fresh filter, to ref. The
+ * filter coefficients are taken from a state for the same samplerate. */
+static int reference_add(struct reference* ref, const float* input,
+                         size_t frames, unsigned channels,
+                         unsigned long samplerate) {
+  ebur128_state* st = ebur128_init(channels, samplerate, EBUR128_MODE_I);
+  double* energy = calloc(frames, sizeof(double));
+  size_t hop, i, end, k;
+  unsigned c;
+
+  if (!st || !energy) return 1;
+  hop = st->d->samples_in_100ms;
+  for (c = 0; c < channels; ++c) {
+    double v[5] = {0.0, 0.0, 0.0, 0.0, 0.0};
+    double weight = ebur128_channel_weight(st->d->channel_map[c]);
+    for (i = 0; i < frames; ++i) {
+      double y;
+      v[0] = (double) input[i * channels + c] - st->d->a[1] * v[1] -
+             st->d->a[2] * v[2] - st->d->a[3] * v[3] - st->d->a[4] * v[4];
+      y = st->d->b[0] * v[0] + st->d->b[1] * v[1] + st->d->b[2] * v[2] +
+          st->d->b[3] * v[3] + st->d->b[4] * v[4];
+      energy[i] += weight * (y * y);
+      v[4] = v[3];
+      v[3] = v[2];
+      v[2] = v[1];
+      v[1] = v[0];
+    }
+  }
+  ebur128_destroy(&st);
+
+  ref->blocks = realloc(ref->blocks,
+                        (ref->num_blocks + frames / hop) * sizeof(double));
+  ref->short_term = realloc(ref->short_term, (ref->num_short_term +
+                                              frames / hop) * sizeof(double));
+  if (!ref->blocks || !ref->short_term) return 1;
+  for (end = 4 * hop; end <= frames; end += hop) {
+    double sum = 0.0;
+    for (k = end - 4 * hop; k < end; ++k) sum += energy[k];
+    sum /= (double) (4 * hop);
+    if (sum >= histogram_energy_boundaries[0]) {
+      ref->blocks[ref->num_blocks++] = sum;
+    }
+  }
+  for (end = 30 * hop; end <= frames; end += 10 * hop) {
+    double sum = 0.0;
+    for (k = end - 30 * hop; k < end; ++k) sum += energy[k];
+    sum /= (double) (30 * hop);
+    if (sum >= histogram_energy_boundaries[0]) {
+      ref->short_term[ref->num_short_term++] = sum;
+    }
+  }
+  free(energy);
+  return 0;
+}
+
+static double reference_loudness(const struct reference* ref) {
+  double threshold = 0.0, sum = 0.0;
+  size_t i, n = 0;
+
+  for (i = 0; i < ref->num_blocks; ++i) threshold += ref->blocks[i];
+  threshold = threshold / (double) ref->num_blocks * relative_gate_factor;
+  for (i = 0; i < ref->num_blocks; ++i) {
+    if (ref->blocks[i] >= threshold) {
+      sum += ref->blocks[i];
+      ++n;
+    }
+  }
+  return ebur128_energy_to_loudness(sum / (double) n);
+}
+
+static double reference_range(const struct reference* ref) {
+  double threshold = 0.0;
+  double* gated = ref->short_term;
+  size_t i, n = ref->num_short_term;
+
+  qsort(ref->short_term, n, sizeof(double), ebur128_double_cmp);
+  for (i = 0; i < n; ++i) threshold += ref->short_term[i];
+  threshold = threshold / (double) n * minus_twenty_decibels;
+  while (n > 0 && *gated < threshold) {
+    ++gated;
+    --n;
+  }
+  return ebur128_energy_to_loudness(gated[(size_t) ((n - 1) * 0.95 + 0.5)]) -
+         ebur128_energy_to_loudness(gated[(size_t) ((n - 1) * 0.1 + 0.5)]);
+}
+
+static void add_chunks(ebur128_state* st, const float* input, size_t frames) {
+  size_t pos, n;
+
+  for (pos = 0, n = 1; pos < frames; pos += n) {
+    n = 1 + (pos * 7919 + 13) % 6007;
+    if (n > frames - pos) n = frames - pos;
+    ebur128_add_frames_float(st, input + pos * st->channels, n);
+  }
+}
+
+static int failed, total;
+
+static void check(const char* name, ebur128_state* st, double loudness,
+                  double range) {
+  double i, lra;
+
+  ebur128_loudness_global(st, &i);
+  ebur128_loudness_range(st, &lra);
+  ++total;
+  if (!(fabs(i - loudness) < LIMIT) || !(fabs(lra - range) < LIMIT)) {
+    printf("%s: I %.12f / %.12f, LRA %.12f / %.12f\n", name, loudness, i,
+           range, lra);
+    ++failed;
+  }
+}
+
+int main(void) {
+  const int mode = EBUR128_MODE_I | EBUR128_MODE_LRA;
+  const size_t frames = SECONDS * SAMPLERATE;
+  struct reference ref = {NULL, 0, NULL, 0}, ref2 = {NULL, 0, NULL, 0};
+  float* input = generate(frames, CHANNELS, SAMPLERATE);
+  float* other = generate(30 * 44100, 5, 44100);
+  float* second = generate(frames, CHANNELS, 2 * SAMPLERATE);
+  double loudness, range;
+  size_t blocks, short_term;
+  ebur128_state* st;
+
+  if (!input || !other || !second ||
+      reference_add(&ref, input, frames, CHANNELS, SAMPLERATE)) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  loudness = reference_loudness(&ref);
+  range = reference_range(&ref);
+  blocks = ref.num_blocks;
+  short_term = ref.num_short_term;
+
+  st = ebur128_init(CHANNELS, SAMPLERATE, mode);
+  if (!st) return 1;
+  ebur128_add_frames_float(st, input, frames);
+  check("one call", st, loudness, range);
+  ebur128_destroy(&st);
+
+  st = ebur128_init(CHANNELS, SAMPLERATE, mode);
+  if (!st) return 1;
+  add_chunks(st, input, frames);
+  check("chunks", st, loudness, range);
+
+  /* same parameters: the chunks of the lists are kept for reuse */
+  ebur128_reset(st, CHANNELS, SAMPLERATE);
+  add_chunks(st, input, frames);
+  check("reset", st, loudness, range);
+  ebur128_destroy(&st);
+
+  st = ebur128_init(5, 44100, mode);
+  if (!st) return 1;
+  add_chunks(st, other, 30 * 44100);
+  ebur128_reset(st, CHANNELS, SAMPLERATE);
+  add_chunks(st, input, frames);
+  check("reset from 5 ch 44.1 kHz", st, loudness, range);
+
+  /* the blocks measured before the change are kept, the filter starts over */
+  ebur128_change_parameters(st, CHANNELS, 2 * SAMPLERATE);
+  add_chunks(st, second, frames);
+  ref2 = ref;
+  if (reference_add(&ref2, second, frames, CHANNELS, 2 * SAMPLERATE)) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  check("change_parameters", st, reference_loudness(&ref2),
+        reference_range(&ref2));
+  ebur128_destroy(&st);
+
+  printf("ebur128_blocks: %d of %d measurements off by %g LU or more "
+         "(%lu gating blocks, %lu short-term blocks)\n", failed, total, LIMIT,
+         (unsigned long) blocks, (unsigned long) short_term);
+  free(ref2.blocks);
+  free(ref2.short_term);
+  free(second);
+  free(other);
+  free(input);
+  return failed != 0;
+}
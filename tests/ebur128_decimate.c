@@ -0,0 +1,153 @@
+/* Reports how far EBUR128_MODE_DECIMATE reads from a full-rate measurement
+ * at 88.2 to 384 kHz. Signals band-limited to 20 kHz have to stay within
+ * 0.075 LU, and sample peaks have to match exactly. White noise is listed
+ * too, it loses its ultrasonic energy and so has no limit. */
+
+#include "ebur128.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHANNELS 2
+#define SECONDS 8
+#define TONES 40
+#define LIMIT 0.075
+#define CHUNK 4096
+
+enum { PINK, ULTRASONIC, SINE_1K, SINE_15K, WHITE, NUM_SIGNALS };
+
+static const char* names[NUM_SIGNALS] = {
+  "multitone", "+ultrasonic", "1 kHz sine", "15 kHz sine", "white noise"
+};
+
+static unsigned long long rng;
+
+static double noise(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return (double) (rng >> 11) / 4503599627370496.0 - 1.0;
+}
+
+/* Adds a tone to one channel, rotating a phasor instead of calling sin for
+ * every sample. */
+static void add_tone(float* buf, size_t frames, int channel,
+                     unsigned long samplerate, double frequency,
+                     double amplitude) {
+  double w = 2.0 * M_PI * frequency / (double) samplerate;
+  double phase = 2.0 * M_PI * (noise() + 1.0) / 2.0;
+  double re = cos(phase), im = sin(phase), c = cos(w), s = sin(w), t;
+  size_t i;
+
+  for (i = 0; i < frames; ++i) {
+    buf[i * CHANNELS + (size_t) channel] += (float) (amplitude * im);
+    t = re * c - im * s;
+    im = re * s + im * c;
+    re = t;
+  }
+}
+
+/* Makes SECONDS of a signal, stepping down 6 dB every 2 seconds so the
+ * gates have something to do. The multitone has a pink spectrum from
+ * 20 Hz to 20 kHz, the ultrasonic variant adds tones up to Nyquist 60 dB
+ * below it. */
+static float* generate(int signal, unsigned long samplerate) {
+  size_t frames = SECONDS * samplerate, i;
+  float* buf = calloc(frames * CHANNELS, sizeof(float));
+  int c, k;
+
+  if (!buf) return NULL;
+  rng = 88172645463325252ULL + samplerate * 7 + (unsigned) signal;
+  for (c = 0; c < CHANNELS; ++c) {
+    if (signal == WHITE) {
+      for (i = 0; i < frames; ++i) {
+        buf[i * CHANNELS + (size_t) c] = (float) (0.15 * noise());
+      }
+    } else if (signal == SINE_1K || signal == SINE_15K) {
+      add_tone(buf, frames, c, samplerate,
+               signal == SINE_1K ? 1000.0 : 15000.0, 0.5);
+    } else {
+      for (k = 0; k < TONES; ++k) {
+        double f = 20.0 * pow(1000.0, (double) k / (TONES - 1));
+        add_tone(buf, frames, c, samplerate, f, 0.1 / sqrt(f / 20.0));
+      }
+      for (k = 0; signal == ULTRASONIC && k < 20; ++k) {
+        double f = 20000.0 + (samplerate / 2.0 - 21000.0) * k / 20.0;
+        add_tone(buf, frames, c, samplerate, f, 0.1 / sqrt(1000.0) * 0.001);
+      }
+    }
+  }
+  for (i = 0; i < frames; ++i) {
+    float gain = (float) pow(10.0, -6.0 * (double) ((i / (2 * samplerate)) % 4)
+                                   / 20.0);
+    for (c = 0; c < CHANNELS; ++c) buf[i * CHANNELS + (size_t) c] *= gain;
+  }
+  return buf;
+}
+
+static void measure(const float* buf, unsigned long samplerate, int mode,
+                    double* loudness, double* peak) {
+  size_t frames = SECONDS * samplerate, pos;
+  ebur128_state* st;
+  double p;
+  unsigned c;
+
+  st = ebur128_init(CHANNELS, samplerate,
+                    EBUR128_MODE_I | EBUR128_MODE_SAMPLE_PEAK | mode);
+  if (!st) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  for (pos = 0; pos < frames; pos += CHUNK) {
+    ebur128_add_frames_float(st, buf + pos * CHANNELS,
+                             frames - pos < CHUNK ? frames - pos : CHUNK);
+  }
+  ebur128_loudness_global(st, loudness);
+  *peak = 0.0;
+  for (c = 0; c < CHANNELS; ++c) {
+    ebur128_sample_peak(st, c, &p);
+    if (p > *peak) *peak = p;
+  }
+  ebur128_destroy(&st);
+}
+
+int main(void) {
+  static const unsigned long samplerates[] = {
+    88200, 96000, 176400, 192000, 352800, 384000
+  };
+  double full, decimated, full_peak, decimated_peak, error, worst = 0.0;
+  int r, signal, failed = 0;
+
+  printf("%8s %-12s %10s %10s %8s\n", "rate", "signal", "full", "decimated",
+         "error");
+  for (r = 0; r < 6; ++r) {
+    for (signal = 0; signal < NUM_SIGNALS; ++signal) {
+      float* buf = generate(signal, samplerates[r]);
+      int bad;
+
+      if (!buf) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+      }
+      measure(buf, samplerates[r], 0, &full, &full_peak);
+      measure(buf, samplerates[r], EBUR128_MODE_DECIMATE, &decimated,
+              &decimated_peak);
+      free(buf);
+
+      error = decimated - full;
+      bad = decimated_peak != full_peak ||
+            (signal != WHITE && !(fabs(error) < LIMIT));
+      if (signal != WHITE && fabs(error) > worst) worst = fabs(error);
+      if (bad) ++failed;
+      printf("%8lu %-12s %10.4f %10.4f %+8.4f%s%s\n", samplerates[r],
+             names[signal], full, decimated, error,
+             decimated_peak != full_peak ? " peak differs" : "",
+             bad ? " FAILED" : "");
+    }
+  }
+
+  printf("ebur128_decimate: %d failed, worst band-limited error %.3f LU\n",
+         failed, worst);
+  return failed != 0;
+}
@@ -0,0 +1,76 @@
+/* Compares the direct histogram bin lookup with a binary search over the bin
+ * boundaries, which is how the bins were found before. It checks every
+ * boundary, the neighbouring doubles on either side of it, the middle of
+ * every bin, values outside the histogram and a sweep over the range in
+ * between. The static functions are reached by including ebur128.c. */
+
+#include "ebur128.c"
+
+static size_t search_histogram_index(double energy) {
+  size_t index_min = 0;
+  size_t index_max = 1000;
+  size_t index_mid;
+
+  do {
+    index_mid = (index_min + index_max) / 2;
+    if (energy >= histogram_energy_boundaries[index_mid]) {
+      index_min = index_mid;
+    } else {
+      index_max = index_mid;
+    }
+  } while (index_max - index_min != 1);
+
+  return index_min;
+}
+
+static long checked, failed;
+
+static void check(double energy) {
+  size_t expected = search_histogram_index(energy);
+  size_t index = find_histogram_index(energy);
+
+  ++checked;
+  if (index != expected) {
+    ++failed;
+    printf("energy %.17g: bin %lu, expected %lu\n", energy,
+           (unsigned long) index, (unsigned long) expected);
+  }
+}
+
+int main(void) {
+  static const double outside[] = {0.0, 1e-300, 1e-20, 1e3, 1e10, 1e300};
+  ebur128_state* st;
+  double below, above;
+  size_t i;
+
+  /* the boundaries are filled in by the first histogram state */
+  st = ebur128_init(1, 48000, EBUR128_MODE_I | EBUR128_MODE_HISTOGRAM);
+  if (!st) return 1;
+  ebur128_destroy(&st);
+
+  for (i = 0; i < 1001; ++i) {
+    double boundary = histogram_energy_boundaries[i];
+
+    below = nextafter(boundary, 0.0);
+    above = nextafter(boundary, HUGE_VAL);
+    check(boundary);
+    check(below);
+    check(above);
+    check(nextafter(below, 0.0));
+    check(nextafter(above, HUGE_VAL));
+    if (i < 1000) {
+      check(sqrt(boundary * histogram_energy_boundaries[i + 1]));
+    }
+  }
+  for (i = 0; i < sizeof(outside) / sizeof(outside[0]); ++i) {
+    check(outside[i]);
+  }
+  check(HUGE_VAL);
+  for (i = 0; i <= 1000000; ++i) {
+    check(pow(10.0, -8.0 + 12.0 * (double) i / 1000000.0));
+  }
+
+  printf("ebur128_histogram: %ld of %ld energies in a different bin\n",
+         failed, checked);
+  return failed != 0;
+}
@@ -0,0 +1,190 @@
+/* Measures the same input once with the scalar filter and once with every
+ * SIMD instruction set the CPU supports, forced on the state, and fails if
+ * any loudness or peak value differs in a single bit. It covers mono, stereo,
+ * 5.1 and odd channel counts, a map where two channels share filter state,
+ * all four input types, interleaved and planar input, and single precision.
+ * The static functions are reached by including ebur128.c. */
+
+#include "ebur128.c"
+
+#include <stdio.h>
+#include <string.h>
+
+#define FRAMES 240000
+#define MAX_CHANNELS 7
+#define NUM_VALUES (4 + 2 * MAX_CHANNELS)
+
+enum { TYPE_SHORT, TYPE_INT, TYPE_FLOAT, TYPE_DOUBLE, NUM_TYPES };
+
+static const char* const type_names[NUM_TYPES] = {
+  "short", "int", "float", "double"
+};
+static const char* const simd_names[] = { "none", "sse2", "avx2", "avx512" };
+
+static double signal[FRAMES * MAX_CHANNELS];
+static short input_short[FRAMES * MAX_CHANNELS];
+static int input_int[FRAMES * MAX_CHANNELS];
+static float input_float[FRAMES * MAX_CHANNELS];
+static double input_double[FRAMES * MAX_CHANNELS];
+
+/* Noise with a slow envelope and a quiet stretch for the gates, a little
+ * louder on every channel. */
+static void generate(void) {
+  unsigned long long rng = 88172645463325252ULL;
+  size_t i, c;
+
+  for (i = 0; i < FRAMES; ++i) {
+    double envelope = 0.5 + 0.45 * sin(2.0 * M_PI * (double) i / 30011.0);
+    if (i > FRAMES / 2 && i < FRAMES / 2 + 9600) envelope = 0.001;
+    for (c = 0; c < MAX_CHANNELS; ++c) {
+      rng ^= rng << 13;
+      rng ^= rng >> 7;
+      rng ^= rng << 17;
+      signal[i * MAX_CHANNELS + c] =
+          envelope * (0.6 + 0.05 * (double) c) *
+          ((double) (rng >> 11) / 4503599627370496.0 - 1.0);
+    }
+  }
+}
+
+/* Lays out the signal of the first channels interleaved or planar. */
+static void convert(unsigned channels, int planar) {
+  size_t i, c;
+
+  for (i = 0; i < FRAMES; ++i) {
+    for (c = 0; c < channels; ++c) {
+      double s = signal[i * MAX_CHANNELS + c];
+      size_t j = planar ? c * FRAMES + i : i * channels + c;
+      input_short[j] = (short) (s * 32767.0);
+      input_int[j] = (int) (s * 2147483647.0);
+      input_float[j] = (float) s;
+      input_double[j] = s;
+    }
+  }
+}
+
+static int add_frames(ebur128_state* st, int type, int planar, size_t pos,
+                      size_t frames) {
+  unsigned channels = st->channels;
+  const void* planes[MAX_CHANNELS];
+  size_t c;
+
+  if (!planar) {
+    switch (type) {
+    case TYPE_SHORT:
+      return ebur128_add_frames_short(st, input_short + pos * channels,
+                                      frames);
+    case TYPE_INT:
+      return ebur128_add_frames_int(st, input_int + pos * channels, frames);
+    case TYPE_FLOAT:
+      return ebur128_add_frames_float(st, input_float + pos * channels,
+                                      frames);
+    default:
+      return ebur128_add_frames_double(st, input_double + pos * channels,
+                                       frames);
+    }
+  }
+  for (c = 0; c < channels; ++c) {
+    switch (type) {
+    case TYPE_SHORT: planes[c] = input_short + c * FRAMES + pos; break;
+    case TYPE_INT: planes[c] = input_int + c * FRAMES + pos; break;
+    case TYPE_FLOAT: planes[c] = input_float + c * FRAMES + pos; break;
+    default: planes[c] = input_double + c * FRAMES + pos; break;
+    }
+  }
+  switch (type) {
+  case TYPE_SHORT:
+    return ebur128_add_frames_planar_short(st, (const short**) planes, frames);
+  case TYPE_INT:
+    return ebur128_add_frames_planar_int(st, (const int**) planes, frames);
+  case TYPE_FLOAT:
+    return ebur128_add_frames_planar_float(st, (const float**) planes, frames);
+  default:
+    return ebur128_add_frames_planar_double(st, (const double**) planes,
+                                            frames);
+  }
+}
+
+/* Measures the converted input with the filter forced to the given
+ * instruction set. The chunks have odd lengths so the kernels see tails. */
+static int measure(unsigned channels, const int* map, int simd, int mode,
+                   int type, int planar, double* values) {
+  ebur128_state* st = ebur128_init(channels, 48000, mode);
+  size_t pos, frames;
+  unsigned c;
+
+  if (!st) return 1;
+  if (map) {
+    for (c = 0; c < channels; ++c) ebur128_set_channel(st, c, map[c]);
+  }
+  st->d->simd = simd;
+  ebur128_init_kernel(st);
+  for (pos = 0, frames = 997; pos < FRAMES; pos += frames, frames += 611) {
+    if (frames > FRAMES - pos) frames = FRAMES - pos;
+    if (add_frames(st, type, planar, pos, frames)) {
+      ebur128_destroy(&st);
+      return 1;
+    }
+  }
+  memset(values, 0, NUM_VALUES * sizeof(double));
+  ebur128_loudness_global(st, &values[0]);
+  ebur128_loudness_range(st, &values[1]);
+  ebur128_loudness_momentary(st, &values[2]);
+  ebur128_loudness_shortterm(st, &values[3]);
+  for (c = 0; c < channels; ++c) {
+    ebur128_sample_peak(st, c, &values[4 + 2 * c]);
+    ebur128_true_peak(st, c, &values[5 + 2 * c]);
+  }
+  ebur128_destroy(&st);
+  return 0;
+}
+
+int main(void) {
+  static const unsigned channels[] = {1, 2, 3, 5, 6, 7, 3};
+  static const int shared[] = {
+    EBUR128_LEFT, EBUR128_RIGHT, EBUR128_LEFT
+  };
+  static const int modes[] = {
+    EBUR128_MODE_I | EBUR128_MODE_LRA | EBUR128_MODE_TRUE_PEAK,
+    EBUR128_MODE_I | EBUR128_MODE_LRA | EBUR128_MODE_TRUE_PEAK |
+        EBUR128_MODE_SINGLE_PRECISION
+  };
+  double expected[NUM_VALUES], values[NUM_VALUES];
+  int supported = ebur128_simd();
+  int l, m, type, planar, simd, failed = 0, total = 0;
+
+  generate();
+  for (l = 0; l < 7; ++l) {
+    for (planar = 0; planar < 2; ++planar) {
+      convert(channels[l], planar);
+      for (m = 0; m < 2; ++m) {
+        for (type = 0; type < NUM_TYPES; ++type) {
+          const int* map = l == 6 ? shared : NULL;
+          if (measure(channels[l], map, EBUR128_SIMD_NONE, modes[m], type,
+                      planar, expected)) {
+            fprintf(stderr, "could not measure %u channels\n", channels[l]);
+            return 1;
+          }
+          for (simd = EBUR128_SIMD_SSE2; simd <= supported; ++simd) {
+            ++total;
+            if (measure(channels[l], map, simd, modes[m], type, planar,
+                        values) ||
+                memcmp(values, expected, sizeof(values))) {
+              printf("%u ch%s %s%s%s with %s: I %.17g / %.17g, "
+                     "LRA %.17g / %.17g\n",
+                     channels[l], map ? " (shared)" : "", type_names[type],
+                     planar ? " planar" : "", m ? " single" : "",
+                     simd_names[simd], expected[0], values[0], expected[1],
+                     values[1]);
+              ++failed;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  printf("ebur128_simd: %d of %d measurements differ from the scalar filter "
+         "(%s supported)\n", failed, total, simd_names[supported]);
+  return failed != 0;
+}
@@ -0,0 +1,117 @@
+/* Measures a synthetic corpus with and without EBUR128_MODE_SINGLE_PRECISION
+ * and fails if integrated loudness or loudness range differ by 0.01 LU or
+ * more. A ten minute track shows the error does not grow with length. */
+
+#include "ebur128.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LIMIT 0.01
+#define CHUNK 4096
+
+static unsigned long long rng;
+
+static double noise(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return (double) (rng >> 11) / 4503599627370496.0 - 1.0;
+}
+
+/* Fills frames [pos, pos + frames) of signal kind: 0 is a sine per channel,
+ * 1 white noise, 2 noise with quiet parts for the gates, 3 noise close to
+ * full scale. Each has a slow envelope. */
+static void generate(float* buf, size_t pos, size_t frames, unsigned channels,
+                     unsigned long samplerate, int kind) {
+  size_t i;
+  unsigned c;
+
+  for (i = 0; i < frames; ++i) {
+    double t = (double) (pos + i) / (double) samplerate;
+    double envelope = 0.5 + 0.45 * sin(2.0 * M_PI * 0.13 * t);
+    double gain = kind == 3 ? 0.99 : 0.7;
+
+    if (kind == 2 && ((pos + i) / (samplerate / 3)) % 5 == 0) {
+      envelope = 0.0005;
+    }
+    for (c = 0; c < channels; ++c) {
+      double s = kind == 0 ? sin(2.0 * M_PI * (997.0 + 100.0 * c) * t)
+                           : noise();
+      buf[i * channels + c] = (float) (envelope * gain * s);
+    }
+  }
+}
+
+/* Returns the larger of the integrated loudness and loudness range error. */
+static double compare(unsigned channels, unsigned long samplerate, int kind,
+                      int mode, double seconds) {
+  ebur128_state* st[2];
+  size_t frames = (size_t) (seconds * samplerate), pos;
+  float* buf = malloc(CHUNK * channels * sizeof(float));
+  double loudness[2], range[2], error;
+  int i;
+
+  st[0] = ebur128_init(channels, samplerate, mode);
+  st[1] = ebur128_init(channels, samplerate,
+                       mode | EBUR128_MODE_SINGLE_PRECISION);
+  if (!buf || !st[0] || !st[1]) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  rng = 88172645463325252ULL + channels * 31 + samplerate + (unsigned) kind;
+  for (pos = 0; pos < frames; pos += CHUNK) {
+    size_t n = frames - pos < CHUNK ? frames - pos : CHUNK;
+    generate(buf, pos, n, channels, samplerate, kind);
+    ebur128_add_frames_float(st[0], buf, n);
+    ebur128_add_frames_float(st[1], buf, n);
+  }
+  for (i = 0; i < 2; ++i) {
+    ebur128_loudness_global(st[i], &loudness[i]);
+    ebur128_loudness_range(st[i], &range[i]);
+    ebur128_destroy(&st[i]);
+  }
+  free(buf);
+
+  error = fabs(loudness[1] - loudness[0]);
+  if (fabs(range[1] - range[0]) > error) error = fabs(range[1] - range[0]);
+  if (!(error < LIMIT)) {
+    printf("%u ch %lu Hz kind %d mode %d: I %.4f / %.4f, LRA %.4f / %.4f\n",
+           channels, samplerate, kind, mode, loudness[0], loudness[1],
+           range[0], range[1]);
+  }
+  return error;
+}
+
+int main(void) {
+  static const unsigned channels[] = {1, 2, 5, 6};
+  static const unsigned long samplerates[] = {44100, 48000, 96000, 192000};
+  static const int modes[] = {
+    EBUR128_MODE_I | EBUR128_MODE_LRA,
+    EBUR128_MODE_I | EBUR128_MODE_LRA | EBUR128_MODE_HISTOGRAM
+  };
+  double error, worst = 0.0;
+  int c, s, kind, m, failed = 0, total = 0;
+
+  for (c = 0; c < 4; ++c) {
+    for (s = 0; s < 4; ++s) {
+      for (kind = 0; kind < 4; ++kind) {
+        for (m = 0; m < 2; ++m) {
+          error = compare(channels[c], samplerates[s], kind, modes[m], 6.3);
+          if (!(error < LIMIT)) ++failed;
+          if (error > worst) worst = error;
+          ++total;
+        }
+      }
+    }
+  }
+  error = compare(2, 48000, 2, modes[0], 600.0);
+  if (!(error < LIMIT)) ++failed;
+  if (error > worst) worst = error;
+  ++total;
+
+  printf("ebur128_single_precision: %d of %d measurements off by %g LU or "
+         "more, worst %.2g LU\n", failed, total, LIMIT, worst);
+  return failed != 0;
+}
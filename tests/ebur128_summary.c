@@ -0,0 +1,103 @@
+/* Measures random albums of tracks with stepped levels through a summary and
+ * through ebur128_loudness_global_multiple, in list and histogram mode, and
+ * fails if the two differ by more than the bound documented for
+ * ebur128_loudness_summary. The static tables are reached by including
+ * ebur128.c. */
+
+#include "ebur128.c"
+
+#include <stdio.h>
+
+#define ALBUMS 300
+#define MAX_TRACKS 8
+#define SAMPLERATE 8000
+#define CHUNK 4000
+
+static unsigned long long rng = 88172645463325252ULL;
+
+static double uniform(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return (double) (rng >> 11) / 9007199254740992.0;
+}
+
+/* Noise whose level steps between -45 and -5 dBFS every 0.5 to 5 seconds,
+ * with a quiet stretch now and then for the gates. */
+static void add_track(ebur128_state* st, double seconds) {
+  float buf[CHUNK];
+  size_t frames = (size_t) (seconds * SAMPLERATE), pos = 0, step = 0, i, n;
+  double gain = 0.0;
+
+  while (pos < frames) {
+    n = frames - pos < CHUNK ? frames - pos : CHUNK;
+    for (i = 0; i < n; ++i) {
+      if (step == 0) {
+        step = (size_t) ((0.5 + 4.5 * uniform()) * SAMPLERATE);
+        gain = uniform() < 0.1 ? 0.0003 : pow(10.0, (-45.0 + 40.0 * uniform())
+                                                        / 20.0);
+      }
+      --step;
+      buf[i] = (float) (gain * (2.0 * uniform() - 1.0));
+    }
+    ebur128_add_frames_float(st, buf, n);
+    pos += n;
+  }
+}
+
+/* 10 * log10(1 + n / N), with n the blocks in the bin of the relative
+ * threshold and N the blocks above that bin. */
+static double bound(const ebur128_summary* summary) {
+  double threshold = 0.0, blocks = 0.0, above = 0.0;
+  size_t j, index;
+
+  for (j = 0; j < 1000; ++j) {
+    threshold += summary->energy[j];
+    blocks += (double) summary->blocks[j];
+  }
+  threshold = threshold / blocks * relative_gate_factor;
+  if (threshold < histogram_energy_boundaries[0]) return 0.0;
+  index = find_histogram_index(threshold);
+  for (j = index + 1; j < 1000; ++j) above += (double) summary->blocks[j];
+  return 10.0 * log10(1.0 + (double) summary->blocks[index] / above);
+}
+
+int main(void) {
+  ebur128_state* sts[MAX_TRACKS];
+  ebur128_summary summary;
+  double multiple, single, error, limit, total = 0.0, worst = 0.0;
+  int album, tracks, t, mode, failed = 0;
+
+  for (album = 0; album < ALBUMS; ++album) {
+    mode = EBUR128_MODE_I;
+    if (album & 1) mode |= EBUR128_MODE_HISTOGRAM;
+    tracks = 2 + (int) (uniform() * (MAX_TRACKS - 1));
+    memset(&summary, 0, sizeof(summary));
+    for (t = 0; t < tracks; ++t) {
+      sts[t] = ebur128_init(1, SAMPLERATE, mode);
+      if (!sts[t]) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+      }
+      add_track(sts[t], 20.0 + 100.0 * uniform());
+      ebur128_add_to_summary(sts[t], &summary);
+    }
+    ebur128_loudness_global_multiple(sts, (size_t) tracks, &multiple);
+    ebur128_loudness_summary(&summary, &single);
+    for (t = 0; t < tracks; ++t) ebur128_destroy(&sts[t]);
+
+    error = fabs(single - multiple);
+    limit = bound(&summary);
+    if (!(error <= limit + 1e-9)) {
+      printf("album %d, %d tracks, mode %d: %.4f / %.4f LUFS, bound %.4f LU\n",
+             album, tracks, mode, multiple, single, limit);
+      ++failed;
+    }
+    if (error > worst) worst = error;
+    total += error;
+  }
+
+  printf("ebur128_summary: %d of %d albums beyond the bound, %.4f LU off on "
+         "average, %.3f LU at worst\n", failed, ALBUMS, total / ALBUMS, worst);
+  return failed != 0;
+}
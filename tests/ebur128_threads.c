@@ -0,0 +1,89 @@
+/* Creates and destroys ebur128 states from several threads at once, at more
+ * samplerates than the filter coefficient cache holds, before any state has
+ * been created. Build it with -fsanitize=thread: besides the races
+ * ThreadSanitizer reports, the loudness every thread measured is checked
+ * against one measured again after the threads are done. */
+
+#include "ebur128.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_THREADS 8
+#define NUM_ROUNDS 40
+#define NUM_RATES 10
+#define FRAMES 48000
+
+static const unsigned long rates[NUM_RATES] = {
+  44100, 48000, 96000, 32000, 22050, 88200, 176400, 192000, 11025, 8000
+};
+static float input[FRAMES * 2];
+static double results[NUM_THREADS][NUM_ROUNDS];
+static pthread_barrier_t start;
+
+static double measure(size_t rate, int round) {
+  int mode = EBUR128_MODE_I | EBUR128_MODE_LRA;
+  ebur128_state* st;
+  double loudness = 0.0;
+
+  if (round & 1) mode |= EBUR128_MODE_HISTOGRAM;
+  st = ebur128_init(2, rates[rate], mode);
+  if (!st) return 1.0;
+  ebur128_add_frames_float(st, input, FRAMES);
+  ebur128_loudness_global(st, &loudness);
+  ebur128_destroy(&st);
+  return loudness;
+}
+
+static void* worker(void* arg) {
+  long id = (long) arg;
+  int round;
+
+  pthread_barrier_wait(&start);
+  for (round = 0; round < NUM_ROUNDS; ++round) {
+    results[id][round] = measure((size_t) (id + round) % NUM_RATES, round);
+  }
+  return NULL;
+}
+
+int main(void) {
+  pthread_t threads[NUM_THREADS];
+  unsigned long seed = 1;
+  double expected[NUM_RATES][2];
+  size_t i;
+  long t;
+  int round, failed = 0;
+
+  for (i = 0; i < FRAMES * 2; ++i) {
+    seed = seed * 1103515245 + 12345;
+    input[i] = (float) ((seed >> 16) % 1000) / 1000.0f - 0.5f;
+  }
+
+  pthread_barrier_init(&start, NULL, NUM_THREADS);
+  for (t = 0; t < NUM_THREADS; ++t) {
+    if (pthread_create(&threads[t], NULL, worker, (void*) t)) {
+      fprintf(stderr, "could not start thread %ld\n", t);
+      return 1;
+    }
+  }
+  for (t = 0; t < NUM_THREADS; ++t) {
+    pthread_join(threads[t], NULL);
+  }
+  pthread_barrier_destroy(&start);
+
+  for (i = 0; i < NUM_RATES; ++i) {
+    expected[i][0] = measure(i, 0);
+    expected[i][1] = measure(i, 1);
+  }
+  for (t = 0; t < NUM_THREADS; ++t) {
+    for (round = 0; round < NUM_ROUNDS; ++round) {
+      size_t rate = (size_t) (t + round) % NUM_RATES;
+      if (results[t][round] != expected[rate][round & 1]) ++failed;
+    }
+  }
+
+  printf("ebur128_threads: %d of %d states measured differently\n",
+         failed, NUM_THREADS * NUM_ROUNDS);
+  return failed != 0;
+}
@@ -0,0 +1,115 @@
+/* Checks EBUR128_MODE_TRUE_PEAK against signals with a known peak. A sine at
+ * a quarter of the samplerate with a 45 degree phase only has samples at
+ * 0.7071 of its amplitude, so its true peak is 3.01 dB above its sample
+ * peak. The true peak has to be within 0.1 dB of the amplitude at every rate
+ * that is oversampled and equal to the sample peak at 192 kHz and above. A
+ * 997 Hz sine and a constant are checked the same way. */
+
+#include "ebur128.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHANNELS 2
+#define SECONDS 1
+#define LIMIT_DB 0.1
+
+enum { QUARTER, SINE_997, CONSTANT, NUM_SIGNALS };
+
+static const char* names[NUM_SIGNALS] = {"fs/4 at 45 deg", "997 Hz", "DC"};
+
+static double sample(int signal, unsigned long samplerate, size_t i,
+                     double amplitude) {
+  switch (signal) {
+  case QUARTER:
+    return amplitude * sin(M_PI / 2.0 * (double) i + M_PI / 4.0);
+  case SINE_997:
+    return amplitude * sin(2.0 * M_PI * 997.0 * (double) i /
+                           (double) samplerate);
+  default:
+    return amplitude;
+  }
+}
+
+/* Returns 1 if the peaks of the signal miss what is expected. */
+static int check(int signal, unsigned long samplerate, double amplitude,
+                 int use_short) {
+  size_t frames = SECONDS * samplerate, warm_up = samplerate / 10, i, c;
+  float* input_float = malloc(frames * CHANNELS * sizeof(float));
+  short* input_short = malloc(frames * CHANNELS * sizeof(short));
+  ebur128_state* st =
+      ebur128_init(CHANNELS, samplerate,
+                   EBUR128_MODE_SAMPLE_PEAK | EBUR128_MODE_TRUE_PEAK);
+  double sample_peak, true_peak, error, expected = amplitude;
+  int failed = 0;
+
+  if (!input_float || !input_short || !st) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  for (i = 0; i < frames; ++i) {
+    for (c = 0; c < CHANNELS; ++c) {
+      double s = sample(signal, samplerate, i, amplitude);
+      input_float[i * CHANNELS + c] = (float) s;
+      input_short[i * CHANNELS + c] = (short) floor(s * 32768.0 + 0.5);
+    }
+  }
+  /* the onset from silence rings above the amplitude, leave it out */
+  if (use_short) {
+    ebur128_add_frames_short(st, input_short, warm_up);
+    ebur128_discard_measurements(st);
+    ebur128_add_frames_short(st, input_short + warm_up * CHANNELS,
+                             frames - warm_up);
+  } else {
+    ebur128_add_frames_float(st, input_float, warm_up);
+    ebur128_discard_measurements(st);
+    ebur128_add_frames_float(st, input_float + warm_up * CHANNELS,
+                             frames - warm_up);
+  }
+
+  for (c = 0; c < CHANNELS; ++c) {
+    ebur128_sample_peak(st, (unsigned) c, &sample_peak);
+    ebur128_true_peak(st, (unsigned) c, &true_peak);
+    if (samplerate >= 192000 && signal == QUARTER) {
+      expected = sample_peak;
+    }
+    error = 20.0 * log10(true_peak / expected);
+    if (!(fabs(error) < LIMIT_DB) || true_peak < sample_peak) {
+      ++failed;
+    }
+    if (c == 0) {
+      printf("%-15s %6lu Hz %-5s %8.5f %8.5f %+7.3f dB%s\n", names[signal],
+             samplerate, use_short ? "short" : "float", sample_peak,
+             true_peak, error, failed ? "  FAIL" : "");
+    }
+  }
+
+  ebur128_destroy(&st);
+  free(input_short);
+  free(input_float);
+  return failed != 0;
+}
+
+int main(void) {
+  static const unsigned long samplerates[] = {44100, 48000, 96000, 192000};
+  static const double amplitudes[] = {0.5, 0.999};
+  int s, r, a, use_short, failed = 0, total = 0;
+
+  printf("%-15s %9s %-5s %8s %8s %10s\n", "signal", "rate", "type", "sample",
+         "true", "error");
+  for (s = 0; s < NUM_SIGNALS; ++s) {
+    for (r = 0; r < 4; ++r) {
+      for (a = 0; a < 2; ++a) {
+        for (use_short = 0; use_short < 2; ++use_short) {
+          failed += check(s, samplerates[r], amplitudes[a], use_short);
+          ++total;
+        }
+      }
+    }
+  }
+
+  printf("ebur128_true_peak: %d of %d signals off by %g dB or more\n", failed,
+         total, LIMIT_DB);
+  return failed != 0;
+}
@@ -0,0 +1,568 @@
+/*
+    ReplayGain scanner test: thousands of files with a flat FD and RSS profile
+
+    Drives rg_scan through a fake host over a directory of short WAV files,
+    once with a decoder for every file, once reading them directly and once
+    decoding and analysing on separate threads, two scans each. While scanning, a thread samples the open descriptors and the
+    resident set size. The test fails if descriptors stay open after a scan,
+    more are open during it than rgscan.open_files allows, a decoder is not
+    freed, the second scan of a kind takes more memory than the first, or a
+    file gets a different gain than with a decoder.
+
+    Linux only, it reads /proc/self.
+*/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <deadbeef/deadbeef.h>              // deadbeef SDK
+#include "ddb_misc_rg_scan.h"
+
+#define NUM_FILES 3000
+#define NUM_THREADS 4
+#define OPEN_FILES 2                        // rgscan.open_files
+#define FILE_RATE 8000
+#define FILE_FRAMES (FILE_RATE / 2)
+#define RSS_SLACK (1 << 20)                 // growth allowed between two scans
+
+DB_plugin_t* ddb_misc_replaygain_scan_load (DB_functions_t *api);
+
+typedef struct {
+    DB_playItem_t item;
+    char uri[PATH_MAX];
+} test_item_t;
+
+typedef struct {
+    DB_fileinfo_t info;
+    int fd;
+    int frames_left;
+} test_fileinfo_t;
+
+static test_item_t items[NUM_FILES];
+static int conf_direct_pcm;
+static int conf_pipeline;
+static float decoder_rg[NUM_FILES];         // track gains of the first decoder scan
+static int have_decoder_rg;
+
+static pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int decoders_open, decoders_peak, decoders_freed, decoders_opened;
+
+static pthread_mutex_t sample_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int sampling, sampler_quit;
+static int fds_peak;
+static long rss_peak;
+
+/* --- host --- */
+
+struct test_thread {
+    void (*fn) (void *ctx);
+    void *ctx;
+};
+
+static void *test_thread_main (void *arg)
+{
+    struct test_thread t = *(struct test_thread *) arg;
+    free (arg);
+    t.fn (t.ctx);
+    return NULL;
+}
+
+static intptr_t test_thread_start (void (*fn) (void *ctx), void *ctx)
+{
+    struct test_thread *t = malloc (sizeof (struct test_thread));
+    pthread_t tid;
+    t->fn = fn;
+    t->ctx = ctx;
+    if (pthread_create (&tid, NULL, test_thread_main, t) != 0) {
+        free (t);
+        return 0;
+    }
+    return (intptr_t) tid;
+}
+
+static int test_thread_join (intptr_t tid)
+{
+    return pthread_join ((pthread_t) tid, NULL);
+}
+
+static uintptr_t test_mutex_create (void)
+{
+    pthread_mutex_t *m = malloc (sizeof (pthread_mutex_t));
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init (&attr);
+    pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init (m, &attr);
+    pthread_mutexattr_destroy (&attr);
+    return (uintptr_t) m;
+}
+
+static void test_mutex_free (uintptr_t m)
+{
+    pthread_mutex_destroy ((pthread_mutex_t *) m);
+    free ((void *) m);
+}
+
+static int test_mutex_lock (uintptr_t m)
+{
+    return pthread_mutex_lock ((pthread_mutex_t *) m);
+}
+
+static int test_mutex_unlock (uintptr_t m)
+{
+    return pthread_mutex_unlock ((pthread_mutex_t *) m);
+}
+
+static uintptr_t test_cond_create (void)
+{
+    pthread_cond_t *c = malloc (sizeof (pthread_cond_t));
+    pthread_cond_init (c, NULL);
+    return (uintptr_t) c;
+}
+
+static void test_cond_free (uintptr_t c)
+{
+    pthread_cond_destroy ((pthread_cond_t *) c);
+    free ((void *) c);
+}
+
+static int test_cond_wait (uintptr_t c, uintptr_t m)
+{
+    return pthread_cond_wait ((pthread_cond_t *) c, (pthread_mutex_t *) m);
+}
+
+static int test_cond_signal (uintptr_t c)
+{
+    return pthread_cond_signal ((pthread_cond_t *) c);
+}
+
+static int test_cond_broadcast (uintptr_t c)
+{
+    return pthread_cond_broadcast ((pthread_cond_t *) c);
+}
+
+static pthread_mutex_t pl_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+static void test_pl_lock (void)
+{
+    pthread_mutex_lock (&pl_mutex);
+}
+
+static void test_pl_unlock (void)
+{
+    pthread_mutex_unlock (&pl_mutex);
+}
+
+static const char *test_pl_find_meta (DB_playItem_t *it, const char *key)
+{
+    if (!strcmp (key, ":URI")) {
+        return ((test_item_t *) it)->uri;
+    }
+    if (!strcmp (key, ":DECODER")) {
+        return "test_wav";
+    }
+    return NULL;
+}
+
+static float test_pl_get_item_duration (DB_playItem_t *it)
+{
+    return (float) FILE_FRAMES / FILE_RATE;
+}
+
+static uint32_t test_pl_get_item_flags (DB_playItem_t *it)
+{
+    return 0;
+}
+
+static void test_pl_item_unref (DB_playItem_t *it)
+{
+}
+
+static int test_conf_get_int (const char *key, int def)
+{
+    if (!strcmp (key, "rgscan.direct_pcm")) {
+        return conf_direct_pcm;
+    }
+    if (!strcmp (key, "rgscan.open_files")) {
+        return OPEN_FILES;
+    }
+    if (!strcmp (key, "rgscan.pipeline")) {
+        return conf_pipeline;
+    }
+    return def;
+}
+
+static float test_conf_get_float (const char *key, float def)
+{
+    return def;
+}
+
+static void test_conf_get_str (const char *key, const char *def, char *buffer, int buffer_size)
+{
+    snprintf (buffer, buffer_size, "%s", def);
+}
+
+static int test_is_local_file (const char *fname)
+{
+    return fname[0] == '/';
+}
+
+// the files are 16 bit, which is all the scanner asks to have converted
+static int test_pcm_convert (const ddb_waveformat_t *inputfmt, const char *input, const ddb_waveformat_t *outputfmt, char *output, int inputsize)
+{
+    int n = inputsize / 2;
+    float *out = (float *) output;
+    for (int i = 0; i < n; i++) {
+        int16_t s;
+        memcpy (&s, input + i * 2, 2);
+        out[i] = s / 32768.f;
+    }
+    return n * 4;
+}
+
+/* --- decoder for the canonical 44 byte header WAV files written below --- */
+
+static DB_decoder_t test_wav;
+
+static DB_fileinfo_t *test_wav_open (uint32_t hints)
+{
+    test_fileinfo_t *info = calloc (1, sizeof (test_fileinfo_t));
+    info->info.plugin = &test_wav;
+    info->fd = -1;
+    pthread_mutex_lock (&count_mutex);
+    decoders_opened++;
+    if (++decoders_open > decoders_peak) {
+        decoders_peak = decoders_open;
+    }
+    pthread_mutex_unlock (&count_mutex);
+    return &info->info;
+}
+
+static int test_wav_init (DB_fileinfo_t *_info, DB_playItem_t *it)
+{
+    test_fileinfo_t *info = (test_fileinfo_t *) _info;
+    info->fd = open (((test_item_t *) it)->uri, O_RDONLY);
+    if (info->fd < 0 || lseek (info->fd, 44, SEEK_SET) != 44) {
+        return -1;
+    }
+    _info->fmt.bps = 16;
+    _info->fmt.channels = 1;
+    _info->fmt.samplerate = FILE_RATE;
+    _info->fmt.channelmask = 1;
+    info->frames_left = FILE_FRAMES;
+    return 0;
+}
+
+static void test_wav_free (DB_fileinfo_t *_info)
+{
+    test_fileinfo_t *info = (test_fileinfo_t *) _info;
+    if (info->fd >= 0) {
+        close (info->fd);
+    }
+    free (info);
+    pthread_mutex_lock (&count_mutex);
+    decoders_open--;
+    decoders_freed++;
+    pthread_mutex_unlock (&count_mutex);
+}
+
+static int test_wav_read (DB_fileinfo_t *_info, char *buffer, int nbytes)
+{
+    test_fileinfo_t *info = (test_fileinfo_t *) _info;
+    int frames = nbytes / 2 < info->frames_left ? nbytes / 2 : info->frames_left;
+    ssize_t size = read (info->fd, buffer, frames * 2);
+    if (size <= 0) {
+        return 0;
+    }
+    info->frames_left -= size / 2;
+    return (int) size;
+}
+
+static int test_wav_seek_sample (DB_fileinfo_t *_info, int sample)
+{
+    test_fileinfo_t *info = (test_fileinfo_t *) _info;
+    if (lseek (info->fd, 44 + sample * 2, SEEK_SET) < 0) {
+        return -1;
+    }
+    info->frames_left = FILE_FRAMES - sample;
+    _info->readpos = (float) sample / FILE_RATE;
+    return 0;
+}
+
+static DB_decoder_t test_wav = {
+    .plugin.type = DB_PLUGIN_DECODER,
+    .plugin.id = "test_wav",
+    .open = test_wav_open,
+    .init = test_wav_init,
+    .free = test_wav_free,
+    .read = test_wav_read,
+    .seek_sample = test_wav_seek_sample,
+};
+
+static DB_decoder_t *decoders[] = { &test_wav, NULL };
+
+static DB_plugin_t *test_plug_get_for_id (const char *id)
+{
+    return !strcmp (id, "test_wav") ? DB_PLUGIN (&test_wav) : NULL;
+}
+
+static DB_decoder_t **test_plug_get_decoder_list (void)
+{
+    return decoders;
+}
+
+static DB_functions_t api = {
+    .thread_start = test_thread_start,
+    .thread_join = test_thread_join,
+    .mutex_create = test_mutex_create,
+    .mutex_create_nonrecursive = test_mutex_create,
+    .mutex_free = test_mutex_free,
+    .mutex_lock = test_mutex_lock,
+    .mutex_unlock = test_mutex_unlock,
+    .cond_create = test_cond_create,
+    .cond_free = test_cond_free,
+    .cond_wait = test_cond_wait,
+    .cond_signal = test_cond_signal,
+    .cond_broadcast = test_cond_broadcast,
+    .pl_lock = test_pl_lock,
+    .pl_unlock = test_pl_unlock,
+    .pl_find_meta = test_pl_find_meta,
+    .pl_find_meta_raw = test_pl_find_meta,
+    .pl_get_item_duration = test_pl_get_item_duration,
+    .pl_get_item_flags = test_pl_get_item_flags,
+    .pl_item_unref = test_pl_item_unref,
+    .plug_get_for_id = test_plug_get_for_id,
+    .plug_get_decoder_list = test_plug_get_decoder_list,
+    .pcm_convert = test_pcm_convert,
+    .conf_get_int = test_conf_get_int,
+    .conf_get_float = test_conf_get_float,
+    .conf_get_str = test_conf_get_str,
+    .is_local_file = test_is_local_file,
+};
+
+/* --- measurements --- */
+
+static int count_fds (void)
+{
+    DIR *dir = opendir ("/proc/self/fd");
+    if (!dir) {
+        return -1;
+    }
+    int n = 0;
+    struct dirent *entry;
+    while ((entry = readdir (dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            n++;
+        }
+    }
+    closedir (dir);
+    return n - 1;                           // without the one of dir
+}
+
+static long resident_bytes (void)
+{
+    FILE *fp = fopen ("/proc/self/statm", "r");
+    long size = 0, resident = 0;
+    if (!fp) {
+        return -1;
+    }
+    if (fscanf (fp, "%ld %ld", &size, &resident) != 2) {
+        resident = -1;
+    }
+    fclose (fp);
+    return resident < 0 ? -1 : resident * sysconf (_SC_PAGESIZE);
+}
+
+static void *sampler (void *arg)
+{
+    for (;;) {
+        pthread_mutex_lock (&sample_mutex);
+        if (sampler_quit) {
+            pthread_mutex_unlock (&sample_mutex);
+            return NULL;
+        }
+        if (sampling) {
+            int fds = count_fds ();
+            long rss = resident_bytes ();
+            if (fds > fds_peak) {
+                fds_peak = fds;
+            }
+            if (rss > rss_peak) {
+                rss_peak = rss;
+            }
+        }
+        pthread_mutex_unlock (&sample_mutex);
+        usleep (5000);
+    }
+}
+
+/* --- test --- */
+
+static int write_files (const char *dir)
+{
+    uint8_t header[44] = {
+        'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+        'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 1, 0,
+        FILE_RATE & 0xff, FILE_RATE >> 8, 0, 0, (FILE_RATE * 2) & 0xff, (FILE_RATE * 2) >> 8, 0, 0, 2, 0, 16, 0,
+        'd', 'a', 't', 'a', 0, 0, 0, 0
+    };
+    uint32_t data_size = FILE_FRAMES * 2;
+    uint32_t riff_size = data_size + 36;
+    for (int i = 0; i < 4; i++) {
+        header[4 + i] = (riff_size >> (8 * i)) & 0xff;
+        header[40 + i] = (data_size >> (8 * i)) & 0xff;
+    }
+
+    int16_t samples[FILE_FRAMES];
+    for (int i = 0; i < NUM_FILES; i++) {
+        for (int j = 0; j < FILE_FRAMES; j++) {
+            samples[j] = (int16_t) lrint (8000 * sin (2 * M_PI * (200 + i % 500) * j / FILE_RATE));
+        }
+        snprintf (items[i].uri, sizeof (items[i].uri), "%s/%04d.wav", dir, i);
+        FILE *fp = fopen (items[i].uri, "wb");
+        if (!fp) {
+            return -1;
+        }
+        int written = fwrite (header, sizeof (header), 1, fp) == 1
+                      && fwrite (samples, sizeof (samples), 1, fp) == 1;
+        if (fclose (fp) != 0 || !written) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void remove_files (const char *dir)
+{
+    for (int i = 0; i < NUM_FILES; i++) {
+        if (items[i].uri[0]) {
+            unlink (items[i].uri);
+        }
+    }
+    rmdir (dir);
+}
+
+/* scans all files, returns the number of problems found */
+static int scan (rg_scan_t *rg, const char *name, int fds_before, long *rss)
+{
+    static DB_playItem_t *scan_items[NUM_FILES];
+    static float track_rg[NUM_FILES], track_pk[NUM_FILES];
+    float album_rg, album_pk, targetdb = 89;
+    int num_tracks = NUM_FILES, num_threads = NUM_THREADS, abort = 0;
+    int problems = 0;
+
+    for (int i = 0; i < NUM_FILES; i++) {
+        scan_items[i] = &items[i].item;
+    }
+    pthread_mutex_lock (&count_mutex);
+    decoders_opened = decoders_freed = decoders_peak = 0;
+    pthread_mutex_unlock (&count_mutex);
+    pthread_mutex_lock (&sample_mutex);
+    fds_peak = 0;
+    rss_peak = 0;
+    sampling = 1;
+    pthread_mutex_unlock (&sample_mutex);
+
+    int res = rg->rg_scan (scan_items, &num_tracks, track_rg, track_pk, &album_rg, &album_pk, &targetdb, &num_threads, &abort);
+
+    pthread_mutex_lock (&sample_mutex);
+    sampling = 0;
+    pthread_mutex_unlock (&sample_mutex);
+    int fds_after = count_fds ();
+    *rss = rss_peak;
+
+    // files read directly count against the budget as well
+    int fds_limit = fds_before + OPEN_FILES;
+    fprintf (stdout, "scan_files: %s: %d descriptors before, at most %d during, %d after, %.1f MB RSS at most\n",
+             name, fds_before, fds_peak, fds_after, rss_peak / 1048576.0);
+    if (res != 0) {
+        fprintf (stdout, "scan_files: %s: rg_scan returned %d\n", name, res);
+        problems++;
+    }
+    for (int i = 0; i < NUM_FILES; i++) {
+        if (!isfinite (track_rg[i]) || track_pk[i] <= 0) {
+            fprintf (stdout, "scan_files: %s: %s has no gain\n", name, items[i].uri);
+            problems++;
+            break;
+        }
+    }
+    if (fds_peak > fds_limit || fds_after != fds_before) {
+        fprintf (stdout, "scan_files: %s: descriptors are not flat\n", name);
+        problems++;
+    }
+    if (decoders_freed != decoders_opened || decoders_peak > OPEN_FILES) {
+        fprintf (stdout, "scan_files: %s: %d decoders opened, %d freed, at most %d open\n",
+                 name, decoders_opened, decoders_freed, decoders_peak);
+        problems++;
+    }
+    if (!conf_direct_pcm && decoders_opened < NUM_FILES) {
+        fprintf (stdout, "scan_files: %s: only %d decoders opened\n", name, decoders_opened);
+        problems++;
+    }
+    if (!conf_direct_pcm && !conf_pipeline && !have_decoder_rg) {
+        memcpy (decoder_rg, track_rg, sizeof (decoder_rg));
+        have_decoder_rg = 1;
+    }
+    for (int i = 0; i < NUM_FILES; i++) {
+        if (track_rg[i] != decoder_rg[i]) {
+            fprintf (stdout, "scan_files: %s: %s has gain %.2f instead of %.2f\n", name, items[i].uri, track_rg[i], decoder_rg[i]);
+            problems++;
+            break;
+        }
+    }
+    return problems;
+}
+
+int main (void)
+{
+    rg_scan_t *rg = (rg_scan_t *) ddb_misc_replaygain_scan_load (&api);
+    char dir[] = "/tmp/rg_scan_test_XXXXXX";
+    if (!mkdtemp (dir)) {
+        fprintf (stderr, "scan_files: could not create a directory\n");
+        return 1;
+    }
+    if (write_files (dir) != 0) {
+        fprintf (stderr, "scan_files: could not write the files\n");
+        remove_files (dir);
+        return 1;
+    }
+
+    pthread_t tid;
+    if (pthread_create (&tid, NULL, sampler, NULL) != 0) {
+        remove_files (dir);
+        return 1;
+    }
+    int fds_before = count_fds ();
+    int problems = 0;
+    long rss[2];
+
+    static const char *names[] = { "decoder", "direct", "pipeline" };
+    for (int kind = 0; kind < 3; kind++) {
+        const char *name = names[kind];
+        conf_direct_pcm = kind == 1;
+        conf_pipeline = kind == 2;
+        problems += scan (rg, name, fds_before, &rss[0]);
+        problems += scan (rg, name, fds_before, &rss[1]);
+        if (rss[1] > rss[0] + RSS_SLACK) {
+            fprintf (stdout, "scan_files: %s: RSS grew by %.1f MB in the second scan\n",
+                     name, (rss[1] - rss[0]) / 1048576.0);
+            problems++;
+        }
+    }
+
+    pthread_mutex_lock (&sample_mutex);
+    sampler_quit = 1;
+    pthread_mutex_unlock (&sample_mutex);
+    pthread_join (tid, NULL);
+    remove_files (dir);
+
+    fprintf (stdout, "scan_files: %d problem(s) in 6 scans of %d files\n", problems, NUM_FILES);
+    return problems != 0;
+}